@@ -0,0 +1,244 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "skibus.h"
+
+// Tests of libskibus (make check): every backend runs a small scenario plain,
+// with the express bus and with runs, the fork backend also with routes, and
+// the output lines are checked against the rules of the assignment.
+
+#define L 100 // skiers
+#define Z 5 // stops
+#define K 10 // bus capacity
+#define TL 100 // max skier time
+#define TB 100 // max bus ride
+
+static int failures; // number of failed checks
+static pid_t check_pid; // the harness, every other process is one the library forked
+static int atexit_pipe[2]; // processes of the library that run check_atexit() write here
+
+// reports a failed check of the named run (line = output line, 0 = none)
+static void fail(const char *name, int line, const char *what) {
+    if(line > 0) {
+        fprintf(stderr, "FAIL %s: line %d: %s\n", name, line, what);
+    }
+    else {
+        fprintf(stderr, "FAIL %s: %s\n", name, what);
+    }
+    failures++;
+}
+
+// tells the harness if a process of the library runs the atexit handlers of the program
+static void check_atexit() {
+    if(getpid() != check_pid && write(atexit_pipe[1], "x", 1) == -1) {
+        _exit(1);
+    }
+}
+
+// returns 1 if the text starts with the prefix
+static int starts(const char *text, const char *prefix) {
+    return strncmp(text, prefix, strlen(prefix)) == 0;
+}
+
+// checks the lines of one route and counts the skiers that went skiing in gone
+static void check_lines(const char *name, const char *lines, int gone[]) {
+    int stops[L + 1] = {0}; // stop every skier waits at
+    int bus = 0; // stop the bus is at (0 = driving, Z + 1 = final)
+    int on_board = 0;
+    int number = 0;
+    const char *last = "";
+    for(const char *line = lines; *line != '\0'; ) {
+        const char *end = strchr(line, '\n');
+        if(end == NULL) {
+            fail(name, number + 1, "line without a newline");
+            return;
+        }
+        number++;
+        int A, skier, stop, offset = 0;
+        if(sscanf(line, "%d: %n", &A, &offset) != 1 || offset == 0 || A != number) {
+            fail(name, number, "wrong line number");
+            return;
+        }
+        const char *text = line + offset;
+        if(starts(text, "BUS: ")) {
+            if(starts(text + 5, "arrived to final\n")) {
+                bus = Z + 1;
+            }
+            else if(sscanf(text + 5, "arrived to %d", &stop) == 1) {
+                bus = stop;
+            }
+            else if(starts(text + 5, "leaving")) {
+                bus = 0;
+            }
+        }
+        else if(sscanf(text, "L %d: %n", &skier, &offset) == 1 && skier >= 1 && skier <= L) {
+            const char *event = text + offset;
+            if(sscanf(event, "arrived to %d", &stop) == 1) {
+                stops[skier] = stop;
+            }
+            else if(starts(event, "boarding\n")) {
+                if(stops[skier] == 0 || stops[skier] != bus) {
+                    fail(name, number, "boarding away from the bus");
+                }
+                if(++on_board > K) {
+                    fail(name, number, "more than K skiers on board");
+                }
+            }
+            else if(starts(event, "going to ski\n") || starts(event, "transferring")) {
+                if(bus != Z + 1) {
+                    fail(name, number, "getting off away from the final stop");
+                }
+                gone[skier] += (event[0] == 'g');
+                stops[skier] = 0;
+                on_board--;
+            }
+        }
+        else {
+            fail(name, number, "unknown line");
+        }
+        last = text;
+        line = end + 1;
+    }
+    if(!starts(last, "BUS: finish\n")) {
+        fail(name, 0, "the bus did not finish last");
+    }
+}
+
+// checks that every skier went skiing the given number of times
+static void check_gone(const char *name, int gone[], int times) {
+    for(int skier = 1; skier <= L; skier++) {
+        if(gone[skier] != times) {
+            char what[64];
+            snprintf(what, sizeof(what), "L %d went skiing %d times instead of %d", skier, gone[skier], times);
+            fail(name, 0, what);
+            return;
+        }
+    }
+}
+
+// reads the whole file into a NUL terminated buffer (NULL = failed)
+static char *read_file(const char *path) {
+    FILE *file = fopen(path, "r");
+    if(file == NULL) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+    char *lines = malloc(size + 1);
+    if(lines != NULL) {
+        lines[fread(lines, 1, size, file)] = '\0';
+    }
+    fclose(file);
+    return lines;
+}
+
+// runs the scenario on the backend with the option (NULL = none) and checks the output
+static void check_run(const char *name, int backend, const char *option, const char *value) {
+    int failed = failures;
+    skibus_sim *sim = skibus_create();
+    if(sim == NULL) {
+        fail(name, 0, "skibus_create() failed");
+        return;
+    }
+    int routes = (option != NULL && strcmp(option, "routes") == 0) ? atoi(value) : 1;
+    int times = (option != NULL && strcmp(option, "runs") == 0) ? atoi(value) : 1;
+    const char *error = skibus_backend(sim, backend);
+    if(error == NULL) {
+        error = skibus_scenario(sim, L, Z, K, TL, TB);
+    }
+    if(error == NULL && option != NULL) {
+        error = skibus_option(sim, option, value);
+    }
+    // routes write a file each
+    if(error == NULL && routes > 1) {
+        error = skibus_sink_file(sim, "check.out");
+    }
+    else if(error == NULL) {
+        skibus_sink_buffer(sim);
+    }
+    if(error == NULL) {
+        error = skibus_run(sim);
+    }
+    if(error != NULL) {
+        fail(name, 0, error);
+        skibus_destroy(sim);
+        return;
+    }
+    if(skibus_wait(sim) != 0) {
+        fail(name, 0, "skibus_wait() failed");
+        skibus_destroy(sim);
+        return;
+    }
+    int gone[L + 1] = {0};
+    if(routes == 1) {
+        check_lines(name, skibus_buffer(sim, NULL), gone);
+    }
+    for(int route = 1; routes > 1 && route <= routes; route++) {
+        char path[32];
+        snprintf(path, sizeof(path), "check.%d.out", route);
+        char *lines = read_file(path);
+        if(lines == NULL) {
+            fail(name, 0, "output file of a route is missing");
+            break;
+        }
+        check_lines(name, lines, gone);
+        free(lines);
+    }
+    check_gone(name, gone, times);
+    skibus_destroy(sim);
+    printf("%-12s %s\n", name, (failures == failed) ? "ok" : "FAILED");
+}
+
+// a run whose replay file is missing fails and leaves no arrivals to the next run
+static void check_failed_replay() {
+    skibus_sim *sim = skibus_create();
+    if(sim == NULL) {
+        fail("failed replay", 0, "skibus_create() failed");
+        return;
+    }
+    skibus_backend(sim, SKIBUS_CORO);
+    skibus_scenario(sim, L, Z, K, TL, TB);
+    skibus_option(sim, "arrivals", "replay:check.missing");
+    skibus_sink_buffer(sim);
+    if(skibus_run(sim) == NULL) {
+        fail("failed replay", 0, "a missing replay file did not fail the run");
+        skibus_wait(sim);
+    }
+    skibus_destroy(sim);
+    check_run("after replay", SKIBUS_CORO, NULL, NULL);
+}
+
+int main() {
+    check_pid = getpid();
+    if(pipe(atexit_pipe) == -1 || fcntl(atexit_pipe[0], F_SETFL, O_NONBLOCK) == -1 || atexit(check_atexit) != 0) {
+        fprintf(stderr, "ERROR: Failed to create a pipe!\n");
+        return 1;
+    }
+    // the library must neither reseed nor draw from the program's rand()
+    srand(1);
+    int expected = rand();
+    srand(1);
+    check_run("fork", SKIBUS_FORK, NULL, NULL);
+    check_run("fork express", SKIBUS_FORK, "express", NULL);
+    check_run("fork runs", SKIBUS_FORK, "runs", "3");
+    check_run("fork routes", SKIBUS_FORK, "routes", "3");
+    check_run("coro", SKIBUS_CORO, NULL, NULL);
+    check_run("coro express", SKIBUS_CORO, "express", NULL);
+    check_run("coro runs", SKIBUS_CORO, "runs", "3");
+    check_failed_replay();
+    if(rand() != expected) {
+        fail("library", 0, "the runs changed the state of rand()");
+    }
+    char byte;
+    if(read(atexit_pipe[0], &byte, 1) == 1) {
+        fail("library", 0, "a forked process ran the atexit handlers of the program");
+    }
+    if(failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,3990 @@
+#define _GNU_SOURCE // pipe2(), accept4() and sem_clockwait()
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <math.h>
+#include <getopt.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/prctl.h>
+#include <sched.h>
+#include <pthread.h>
+#include "skibus.h"
+
+// Execution engines
+#define ENGINE_FORK SKIBUS_FORK // one process per skier and one for the bus
+#define ENGINE_CORO SKIBUS_CORO // bus and skiers as coroutines inside this process
+
+#define MAX_STOPS 10 // Z limit
+#define FORK_MAX_SKIERS 20000 // L limit when every skier is a process
+#define SPAWN_FALLBACK 2 // run_fork() could not start the bus, so the coroutine engine has to run
+#define SPAWN_PROC_BYTES (512 * 1024) // memory a bus or skier process is expected to use
+#define SPAWN_RESERVE 16 // processes left to the rest of the user's session
+#define SPAWN_BACKOFF_US 1000 // first backoff after a failed fork(), doubled on every retry
+#define SPAWN_MAX_RETRIES 10 // failed fork() calls in a row before giving up
+#define CORO_MAX_SKIERS 1000000 // L limit when every skier is a coroutine
+#define MAX_ROUTES 8 // limit of --routes
+#define EXIT_STALL SKIBUS_STALL // exit code of a run the stall detector stopped
+#define K_MIN 10 // smallest skibus capacity
+#define K_MAX 100 // largest skibus capacity
+
+// Positional arguments of a simulation
+typedef struct scenario {
+    int L; // number of skiers
+    int Z; // number of boarding stops
+    int K; // skibus capacity
+    int TL; // max time in micro seconds that a skier waits before he comes to a bus stop
+    int TB; // max time of bus ride between two stops
+} scenario;
+
+// Arrival processes of skiers
+#define ARRIVAL_UNIFORM 0 // up to TL before starting and before every trip (the original model)
+#define ARRIVAL_POISSON 1 // exponential gaps at a constant rate
+#define ARRIVAL_MMPP 2 // Poisson whose rate switches between a calm and a burst state
+#define ARRIVAL_PROFILE 3 // Poisson whose rate follows a repeating piecewise constant profile
+#define ARRIVAL_REPLAY 4 // timestamps recorded in a file
+#define MAX_PROFILE_SEGMENTS 64 // rates a profile may have
+
+// Arrival process of the first trip of every skier
+typedef struct arrival_spec {
+    int kind; // ARRIVAL_*
+    int segments; // number of rates
+    double rates[MAX_PROFILE_SEGMENTS]; // skiers per second (MMPP: calm, burst)
+    double lengths[MAX_PROFILE_SEGMENTS]; // seconds every rate lasts (MMPP: mean time in the state)
+    const char *path; // replay file
+} arrival_spec;
+
+// Options of a simulation (everything besides the five positional arguments)
+typedef struct options {
+    int engine; // ENGINE_FORK or ENGINE_CORO
+    int stats; // print run statistics to stderr when done
+    int express; // bus skips stops nobody waits at
+    int runs; // trips each skier makes (0 = until the duration is over)
+    int duration; // seconds after which skiers stop going again (0 = no limit)
+    char *trace_path; // trace-event JSON output (NULL = no trace)
+    char *daemon_path; // UNIX socket the daemon listens on (NULL = run one simulation)
+    int daemon_jobs; // jobs the daemon runs at once
+    int daemon_pool; // worker processes kept warm for every concurrent job
+    int routes; // number of routes in the network
+    char *arrivals; // arrival process (NULL = uniform)
+    char *stop_weights; // popularity of the stops (NULL = all stops alike)
+    int optimize_us; // p99 wait the optimizer searches K and TB for (0 = run one simulation)
+    int replicas; // runs of every setting the optimizer tries
+    int stall_ms; // time without a new output line after which a blocked wait is a stall (0 = never)
+} options;
+
+#define OPTIMIZE_TB_STEPS 5 // TB values of the optimizer's coarse grid
+#define OPTIMIZE_DEFAULT_REPLICAS 3 // runs of every setting by default
+#define OPTIMIZE_MAX_REPLICAS 100 // limit of --replicas
+
+// Setting of K and TB tried by the optimizer
+typedef struct optimize_point {
+    int K; // skibus capacity
+    int TB; // max time of bus ride between two stops
+    int finished; // replicas that ran to the end
+    int failed; // replicas that missed the SLO (including the ones stopped early)
+    int stopped; // replicas stopped early or not run because another one failed
+    uint64_t p99_us; // worst p99 wait of the replicas that ran to the end
+} optimize_point;
+
+// Result a replica sends to the optimizer
+typedef struct optimize_result {
+    int task; // replica of the batch (point in the batch * replicas + replica)
+    int meets; // 1 if the replica met the SLO
+    int stopped; // 1 if the replica stopped once it could no longer meet the SLO
+    uint64_t p99_us; // exact p99 wait of the replica (0 if stopped)
+} optimize_result;
+
+// State of an --optimize search
+typedef struct optimize_search {
+    scenario sc; // searched scenario, K and TB are the largest values tried
+    arrival_spec *arrivals; // arrival process of every replica
+    int express; // bus skips stops nobody waits at
+    uint64_t slo_us; // p99 wait a setting has to meet
+    int replicas; // runs of every setting
+    int jobs; // replicas run at once
+    unsigned int seed; // replica r of every setting uses seed + r
+    optimize_point *points; // settings tried so far
+    int point_count; // number of points
+    int point_capacity; // number of points there is room for
+    long runs; // replicas started
+} optimize_search;
+
+#define SOAK_WINDOW_S 10 // length of the sliding window soak statistics are reported over
+#define SOAK_RING (SOAK_WINDOW_S + 2) // per second buckets (window + the current and the next second)
+#define SOAK_POLL_US 10000 // how often the fork engine reports while waiting for its children
+#define HIST_BUCKETS 272 // buckets of a wait time histogram (8 per power of 2 below 2^36 us, longer waits count in the last)
+
+// Histogram of skier wait times in micro seconds
+typedef struct wait_histogram {
+    uint64_t count[HIST_BUCKETS];
+} wait_histogram;
+
+// Soak statistics of one second of the run
+typedef struct soak_second {
+    long delivered; // skiers that went skiing
+    wait_histogram waits; // how long skiers waited before boarding
+} soak_second;
+
+// Statistics of a soak run (lives in its own shared mapping)
+typedef struct soak_stats {
+    uint64_t start_us; // monotonic time of second 0
+    long reported; // seconds reported so far
+    long cleared; // last second whose bucket has been cleared for reuse
+    long delivered; // skiers that went skiing during the whole run
+    wait_histogram waits; // wait times during the whole run
+    soak_second seconds[SOAK_RING]; // ring of the last seconds
+} soak_stats;
+
+#define TRACE_MAX_SKIER_TRACKS 1000 // above this many skiers only the per stop counters are traced
+#define TRACE_RECORD_BYTES 192 // longest trace-event JSON record
+
+// Kinds of trace records
+#define TRACE_NONE 0 // nothing, only moves the bus mark
+#define TRACE_DRIVE 1 // bus drives to a stop
+#define TRACE_DWELL 2 // bus stands at a stop
+#define TRACE_WAIT 3 // skier waits at a stop
+#define TRACE_RIDE 4 // skier rides the bus
+#define TRACE_WAITING 5 // counter of skiers waiting at a stop
+#define TRACE_ON_BOARD 6 // counter of skiers on the bus
+
+// Trace record kept in memory until the process flushes its trace
+typedef struct trace_record {
+    uint64_t start_us; // start relative to the run
+    uint64_t end_us; // end relative to the run (= start for counters)
+    int kind; // TRACE_*
+    int track; // 0 = bus, i = skier i, stop for TRACE_WAITING
+    int value; // stop of a duration, value of a counter
+    int route; // route the record belongs to
+} trace_record;
+
+#define DAEMON_MAX_REQUEST 1024 // longest request line a client may send
+#define DAEMON_MAX_JOBS 64 // limit of --jobs
+#define DAEMON_DEFAULT_JOBS 2 // jobs the daemon runs at once by default
+#define DAEMON_DEFAULT_POOL 64 // warm workers per concurrent job by default
+
+// Statistics of process creation in the fork engine
+typedef struct spawn_stats {
+    long wanted; // processes the simulation needs
+    long budget; // processes allowed to run at once
+    long failures; // fork() calls that failed
+    long retries; // fork() calls retried after a failure
+    long throttled; // times spawning waited for a skier to exit
+} spawn_stats;
+
+#define STALL_DEFAULT_MS 10000 // stall timeout by default
+#define STALL_LOG_LINES 16 // output lines kept for the stall dump
+#define STALL_LOG_BYTES 96 // longest output line kept for the stall dump
+
+// Semaphores waited on through stall_wait()
+#define WAIT_STOP 0 // stops_mutex
+#define WAIT_BUS 1 // bus_mutex
+#define WAIT_FINISHED 2 // all_skiers_finished
+#define WAIT_OUTPUT 3 // output_mutex
+#define WAIT_KINDS 4
+
+// Statistics of the waits on one kind of semaphore
+typedef struct wait_stats {
+    long count; // waits
+    long blocked; // waits that had to block
+    uint64_t total_us; // summed time of the blocked waits
+    uint64_t max_us; // longest wait
+} wait_stats;
+
+// Statistics of the bus route
+typedef struct route_stats {
+    long laps; // times the bus arrived to the final stop
+    uint64_t bus_idle_us; // time the bus spent with nobody on board
+    uint64_t bus_mark_us; // when the bus was last accounted for
+    int bus_empty; // whether the bus was empty since bus_mark_us
+    uint64_t wait_us; // summed time skiers waited at their stops
+    long boardings; // number of skiers that boarded
+    long transfers; // skiers taken over from the previous route at the hub
+} route_stats;
+
+// Slot of a hub queue
+typedef struct hub_cell {
+    uint64_t seq; // position the cell is ready for (a push sets it to position + 1)
+    int skier; // skier handed over
+} hub_cell;
+
+// Lock-free queue of skiers transferring from the previous route to stop 1
+// of this one. Any skier of the previous route pushes, only the bus of this
+// route takes. Lives in its own shared mapping, cells follow the header.
+typedef struct hub_queue {
+    uint64_t head; // next position the bus takes
+    char head_pad[56]; // keeps the bus and the skiers off each other's cache line
+    uint64_t tail; // next position a skier pushes to
+    char tail_pad[56];
+    uint64_t mask; // number of cells - 1 (the number of cells is a power of 2)
+    hub_cell cells[]; // ring of skiers
+} hub_queue;
+
+// Sinks of the output lines
+#define SINK_NONE 0 // lines are only counted
+#define SINK_FILE 1 // written to a file
+#define SINK_CALLBACK 2 // passed to a callback
+#define SINK_BUFFER 3 // collected in memory
+
+// Simulation of the library interface (see skibus.h)
+struct skibus_sim {
+    options opts; // options of the run
+    int runs_set; // whether the runs option was given
+    int jobs_set; // whether the jobs option was given
+    scenario sc; // what to simulate
+    int scenario_set; // whether sc has been set
+    int sink; // SINK_*
+    char *sink_path; // output file of SINK_FILE
+    skibus_event_fn callback; // callback of SINK_CALLBACK
+    void *context; // passed to the callback
+    char *buffer; // lines collected by SINK_BUFFER
+    size_t buffer_length; // bytes in buffer
+    size_t buffer_capacity; // bytes buffer has room for
+    int sink_failed; // the buffer could not grow, lines were lost
+    int engine; // engine the run uses (the fork engine may fall back to coroutines)
+    uint64_t start_us; // monotonic time the run started
+    pid_t supervisor; // process that runs and waits for the processes of a fork run (-1 = none)
+    int pipe_fd; // read end of the pipe the processes of a fork run write their lines to (-1 = none)
+    pthread_t reader; // thread delivering the lines from pipe_fd to the sink
+    char error[128]; // error message with details
+};
+
+// Global variables
+typedef struct shared_vars {
+    int *A; // number of lines in the output file/actions
+    int L_count; // total number of skiers (that ride this route)
+    int L_total; // number of skiers in the whole network
+    int route; // number of this route
+    int *L_boarded; // number of skiers onboard
+    int *L_skiing; // number of skiers already skiing
+    int Z_count; // number of stops
+    int Z_mapped; // number of stops the mappings and semaphores were made for
+    int *stops_waiting; // number of skiers at each stop
+    int K_capacity; // bus capacity
+    int skier_max_time; // max time that a skier waits before going to a bus stop
+    int bus_max_time; // max time that the skibus drives to the next bus stop
+    int engine; // engine that runs the simulation
+    int express; // bus skips stops nobody waits at
+    unsigned int stops_bitmap; // bit (stop - 1) is set while skiers wait at the stop
+    route_stats stats; // statistics of the bus route
+    int runs; // trips each skier makes (0 = until the deadline)
+    uint64_t deadline_us; // monotonic time after which skiers stop going again (0 = none)
+    soak_stats *soak; // throughput and wait time statistics of a soak run
+    uint64_t first_event_us; // monotonic time the first line was written
+    int measure_memory; // processes add their PSS to pss_kb when they are done (--stats)
+    long pss_kb; // summed proportional set size of the processes of the route
+    uint64_t start_us; // monotonic time the run started
+    sem_t *bus_mutex; // mutex for the skibus (if it is on final stop or not)
+    sem_t *all_skiers_finished; // mutex for skiers
+    sem_t *output_mutex; // mutex for printing output
+    sem_t *bus_idle; // posted when skiers start waiting while the express bus may have nothing to do
+    sem_t **stops_mutex; // mutexes for all stops (whether or not bus is on stop)
+    hub_queue *hub_in; // skiers transferring to stop 1 from the previous route (NULL = no hub)
+    int bus_stop; // stop the bus is at, Z + 1 for the final stop (0 = not started)
+    int stalled; // set by the process that detected a stall
+    wait_stats waits[WAIT_KINDS]; // waits on the semaphores
+    char log[STALL_LOG_LINES][STALL_LOG_BYTES]; // last output lines (line A is log[A % STALL_LOG_LINES])
+} shared_vars;
+static shared_vars *shared_t;
+static FILE *output_file; // the output file (every process has its own FILE)
+static skibus_sim *active_sim; // simulation between skibus_run() and skibus_wait() (NULL = none)
+static skibus_sim *line_sim; // simulation whose sink takes the lines of this process directly (NULL = output_file)
+
+// Routes of the network. Every route is a shard of its own shared_vars,
+// semaphores and output file, route r ends at a hub feeding stop 1 of route
+// r + 1. Process-local, forked processes inherit it.
+typedef struct route_network {
+    int count; // number of routes
+    shared_vars *routes[MAX_ROUTES]; // shard of every route
+    FILE *files[MAX_ROUTES]; // output file of every route
+    unsigned char (*journeys)[2]; // first and last route of every skier (NULL = one route)
+    int cpus[CPU_SETSIZE]; // CPUs this process may run on
+    int cpu_count; // number of CPUs in cpus
+} route_network;
+static route_network network;
+static uint64_t *arrival_us; // first arrival of every skier since the start (NULL = uniform sleeps)
+static int stop_weights[MAX_STOPS]; // cumulative popularity of the stops (all 0 = uniform)
+static unsigned int rand_state; // random numbers of the simulation, the program's rand() is left alone
+static uint64_t virtual_us; // simulated monotonic time of an optimizer replica (0 = real time)
+static uint64_t slo_us; // p99 wait an optimizer replica has to meet (0 = no SLO)
+static long slo_budget; // waits over slo_us the replica may still have
+static uint64_t *slo_waits; // every wait of the replica, for its exact p99
+static long slo_wait_count; // number of waits in slo_waits
+static uint64_t stall_timeout_us = STALL_DEFAULT_MS * 1000; // see options.stall_ms
+static int stall_self = -1; // who this process is in the stall dump (0 = bus, i = skier i, -1 = main)
+static int trace_fd = -1; // trace-event JSON output shared by all processes (-1 = no trace)
+static trace_record *trace_buffer; // trace records of this process
+static size_t trace_length; // number of records in trace_buffer
+static size_t trace_capacity; // number of records trace_buffer has room for
+static uint64_t trace_mark_us; // when the bus started driving or dwelling
+
+// **********Daemon types**********
+// The daemon keeps one pool of warm worker processes per concurrent job. The
+// workers of a pool are forked once with the pool's shared_vars mapped and
+// take bus and skier tasks of every job that runs in the pool.
+
+// Task queue of a pool (lives in its own shared mapping)
+typedef struct pool_shared {
+    sem_t tasks; // posted once per bus/skier task of the current job
+    int next_task; // next task to take (0 = bus, i = skier i)
+    int job; // id of the current job
+    char path[PATH_MAX]; // output file of the current job
+} pool_shared;
+
+// A scenario request waiting in the queue or running in a pool
+typedef struct daemon_job {
+    struct daemon_job *next; // next job in the queue
+    int id; // job number
+    int client; // socket the reply goes to
+    scenario sc; // what to simulate
+    char path[PATH_MAX]; // output file
+    uint64_t request_us; // when the request was received
+    uint64_t start_us; // when the job was handed to a pool
+} daemon_job;
+
+// Pool of warm workers and the job it runs
+typedef struct daemon_slot {
+    shared_vars *shared; // pre-mapped shared variables of the pool
+    pool_shared *pool; // task queue of the pool
+    pid_t *workers; // worker processes
+    int worker_count; // number of worker processes
+    daemon_job *job; // job running in the pool (NULL = idle)
+} daemon_slot;
+
+// Connection whose request line has not been received completely yet
+typedef struct daemon_client {
+    int fd; // client socket
+    size_t length; // bytes received so far
+    char request[DAEMON_MAX_REQUEST]; // received bytes
+} daemon_client;
+
+static volatile sig_atomic_t daemon_stopping; // set by SIGINT/SIGTERM
+static int pool_done_fd = -1; // where a pool worker reports its pool's index when a job ends or stalls (-1 = no pool)
+static int pool_index; // index of the pool of this worker
+
+// **********Coroutine engine types**********
+// The coroutine engine runs the bus and every skier as stackless coroutines
+// on this one thread. A coroutine keeps everything it needs across a yield in
+// its coro struct and resumes from the line it last yielded on, so a waiting
+// skier costs sizeof(coro) bytes instead of a whole process.
+
+#define CO_DONE 0xffffffffu // resume point of a coroutine that has returned
+#define WHEEL_TICK_US 10 // resolution of the timing wheel
+#define WHEEL_SLOTS 1024 // slots of the timing wheel (must be a power of 2)
+
+// Marks the start of a coroutine body
+#define CO_BEGIN(c) switch((c) -> resume) { case 0:
+// Marks the end of a coroutine body
+#define CO_END(c) } (c) -> resume = CO_DONE
+// Suspends the coroutine for the given number of micro seconds
+#define CO_SLEEP(c, us) \
+    do { co_sleep((c), (us)); (c) -> resume = __LINE__; return; case __LINE__:; } while(0)
+// Decrements the semaphore, suspending the coroutine until it is posted if needed
+#define CO_WAIT(c, sem) \
+    do { if(co_sem_wait((sem), (c)) == 0) { (c) -> resume = __LINE__; return; case __LINE__:; } } while(0)
+
+typedef struct coro {
+    struct coro *next; // link in the run queue, a wait queue or a wheel slot
+    void (*body)(struct coro *); // function that runs the coroutine
+    unsigned int resume; // line to resume from (0 = not started yet)
+    unsigned int rounds; // laps of the timing wheel left before waking up
+    int id; // skier position (0 for the bus)
+    int stop; // stop the coroutine is at
+    int count; // number of skiers the bus is waiting for
+    int i; // loop counter of the bus, trips made by a skier
+    uint64_t since; // when the skier arrived to its stop, then when it boarded
+} coro;
+
+// Cooperative wait queue with the semantics of a semaphore
+typedef struct co_sem {
+    int value; // posts nobody has waited for yet
+    coro *head; // first waiting coroutine
+    coro *tail; // last waiting coroutine
+} co_sem;
+
+typedef struct co_scheduler {
+    coro *run_head; // first coroutine ready to run
+    coro *run_tail; // last coroutine ready to run
+    coro **wheel; // timing wheel of sleeping coroutines
+    uint64_t wheel_tick; // last tick the wheel was advanced to
+    uint64_t start_us; // monotonic time of tick 0
+    long sleeping; // number of coroutines in the wheel
+    long alive; // number of coroutines that have not returned yet
+    int timer_fd; // timerfd armed for the next wheel slot
+    int epoll_fd; // epoll instance the scheduler blocks on
+    coro *coros; // the bus (index 0) and all skiers
+    co_sem bus_sem; // bus is at the final stop
+    co_sem finished_sem; // a skier got on/off the bus
+    co_sem idle_sem; // skiers started waiting while the express bus may have nothing to do
+    co_sem *stop_sems; // bus is at the stop
+    unsigned long resumes; // coroutine switches
+    unsigned long wakeups; // times the scheduler blocked on epoll
+} co_scheduler;
+static co_scheduler co_sched;
+
+// Function prototypes
+static const char *parse_scenario(char *[], int, scenario *);
+static void struct_init(int, FILE *);
+static void shared_reset(scenario *, uint64_t);
+static void struct_destroy();
+static void semaphore_init(int);
+static void semaphore_destroy();
+static void map_memory(int);
+static void unmap_memory();
+static void custom_print(char *, ...);
+static void sink_line(skibus_sim *, const char *, size_t);
+static void *sink_reader(void *);
+static void sink_pipe_open(skibus_sim *);
+static void sink_pipe_detach();
+static void sink_pipe_join(skibus_sim *);
+static char *option_string(char **, const char *);
+static void run_finish(skibus_sim *);
+static int supervisor_wait(pid_t);
+static void stall_wait(sem_t *, int, int);
+static void stall_dump(int, int, uint64_t);
+static void stall_reset();
+static void bus();
+static void skier(int);
+static void stop_enqueue(int);
+static void bus_wake();
+static int stop_board(int);
+static const char *trace_open(const char *);
+static void trace_record_add(int, int, int, uint64_t, uint64_t);
+static void trace_bus(int, int);
+static void trace_flush();
+static void trace_close();
+static int express_next_stop(int);
+static void bus_idle_update();
+static int bus_arrive(int);
+static void bus_leave(int);
+static int skier_arrive(int);
+static uint64_t skier_board(int, int, uint64_t);
+static int skier_unboard(int, int, uint64_t, int);
+static void skier_transfer(int, int, uint64_t, int);
+static int skier_hub(int, int);
+static void route_print_stats();
+static int skier_goes_again(int);
+static int hist_bucket(uint64_t);
+static uint64_t hist_value(int);
+static uint64_t hist_percentile(wait_histogram *, double);
+static void soak_record_wait(uint64_t);
+static void soak_record_delivery();
+static void soak_report(int);
+static void rand_seed(unsigned int);
+static int rand_next();
+static int rand_time(int);
+static void rand_sleep(int);
+static uint64_t monotonic_us();
+static void fork_stats(int, uint64_t);
+static void memory_record();
+static void process_exit(int);
+static int fork_spawn(spawn_stats *);
+static int fork_wait(options *, spawn_stats *, uint64_t, int);
+static const char *arrival_parse(char *, arrival_spec *);
+static const char *arrival_generate(arrival_spec *, int);
+static const char *arrival_replay(const char *, int);
+static double arrival_gap(double);
+static int arrival_delay(int);
+static int compare_u64(const void *, const void *);
+static int compare_double(const void *, const void *);
+static const char *stop_weights_parse(char *, int);
+static int stop_pick();
+static const char *network_open(const char *, int, FILE *[]);
+static void network_init(scenario *, int, FILE *[]);
+static void network_plan(scenario *);
+static void network_truncate(int);
+static void network_destroy();
+static void route_select(int);
+static void route_pin(int);
+static void hub_push(hub_queue *, int);
+static int hub_drain(hub_queue *);
+static int hub_pending(hub_queue *);
+static int run_coro(options *, uint64_t);
+static int run_optimize(options *, scenario *, arrival_spec *);
+static int optimize_find(optimize_search *, int, int);
+static void optimize_evaluate(optimize_search *, int *, int);
+static void optimize_collect(optimize_search *, int *, char *, int);
+static void optimize_replica(optimize_search *, int, int, int);
+static void optimize_record_wait(uint64_t);
+static int optimize_meets(optimize_search *, int);
+static void optimize_report(optimize_search *, int, uint64_t);
+static long spawn_budget(long);
+static long count_user_processes();
+static long available_memory();
+static pid_t spawn_process(spawn_stats *, long *);
+static void spawn_print_stats(spawn_stats *);
+static int soak_enabled();
+static int run_daemon(options *);
+static int pool_init(daemon_slot *, int, int, int);
+static int pool_fork(daemon_slot *, int, int, int);
+static int pool_respawn(daemon_slot *, int, int, int);
+static void pool_destroy(daemon_slot *);
+static void pool_worker(daemon_slot *, int, int);
+static void daemon_signal(int);
+static void daemon_read(daemon_client *, int, int, daemon_job **, daemon_job **, int *);
+static int daemon_start_job(daemon_slot *, daemon_job *);
+static void daemon_finish_job(daemon_slot *);
+static void daemon_reply(int, const char *, ...);
+static void co_init();
+static void co_destroy();
+static int co_run();
+static void co_stats(uint64_t);
+static void co_ready(coro *);
+static void co_sleep(coro *, int);
+static void co_advance_wheel();
+static void co_wait_timer();
+static int co_sem_wait(co_sem *, coro *);
+static void co_sem_post(co_sem *);
+static void co_bus(coro *);
+static void co_skier(coro *);
+
+
+// **********Function definitions**********
+
+// parses the five positional arguments into the scenario, returns an error message or NULL
+static const char *parse_scenario(char *args[], int L_max, scenario *sc) {
+    char *endptr = NULL; // for the strtol function
+
+    // ----------skiers----------
+    // from the command line
+    sc -> L = strtol(args[0], &endptr, 10);
+    // check if the argument is valid
+    if(strlen(endptr) > 0) {
+        return "Invalid L argument.";
+    }
+    // checks if L is in range
+    if(sc -> L >= L_max || sc -> L < 1) {
+        return "L value is out of range!";
+    }
+
+    // ----------stops----------
+    sc -> Z = strtol(args[1], &endptr, 10);
+    if(strlen(endptr) > 0) {
+        return "Invalid Z argument.";
+    }
+    // checks if Z is in range
+    if((sc -> Z <= 0) || (sc -> Z > MAX_STOPS)) {
+        return "Z value is out of range!";
+    }
+
+    // ----------capacity----------
+    sc -> K = strtol(args[2], &endptr, 10);
+    if(strlen(endptr) > 0) {
+        return "Invalid K argument.";
+    }
+    // checks if K is in range
+    if((sc -> K < K_MIN) || (sc -> K > K_MAX)) {
+        return "K value is out of range!";
+    }
+
+    // ----------skier_time----------
+    sc -> TL = strtol(args[3], &endptr, 10);
+    if(strlen(endptr) > 0) {
+        return "Invalid TL argument.";
+    }
+    // checks if TL is in range
+    if((sc -> TL < 0) || (sc -> TL > 10000)) {
+        return "TL value is out of range!";
+    }
+
+    // ----------stop_time----------
+    sc -> TB = strtol(args[4], &endptr, 10);
+    if(strlen(endptr) > 0) {
+        return "Invalid TB argument.";
+    }
+    // checks if TB is in range
+    if((sc -> TB < 0) || (sc -> TB > 1000)) {
+        return "TB value is out of range!";
+    }
+
+    return NULL;
+}
+
+// **********Library interface**********
+// The interface of skibus.h configures a skibus_sim and applies it to the
+// process-wide state of the engine for the one run between skibus_run() and
+// skibus_wait(). Lines of the coroutine engine go to the sink straight from
+// custom_print(); the processes of the fork engine write theirs to a pipe a
+// thread of the calling process reads.
+
+skibus_sim *skibus_create(void) {
+    skibus_sim *sim = calloc(1, sizeof(skibus_sim));
+    if(sim == NULL) {
+        return NULL;
+    }
+    sim -> opts = (options){ENGINE_FORK, 0, 0, 1, 0, NULL, NULL, DAEMON_DEFAULT_JOBS, DAEMON_DEFAULT_POOL, 1, NULL, NULL,
+                            0, OPTIMIZE_DEFAULT_REPLICAS, STALL_DEFAULT_MS};
+    sim -> sink = SINK_NONE;
+    sim -> pipe_fd = -1;
+    sim -> supervisor = -1;
+    return sim;
+}
+
+void skibus_destroy(skibus_sim *sim) {
+    if(sim == NULL) {
+        return;
+    }
+    if(active_sim == sim) {
+        skibus_wait(sim);
+    }
+    free(sim -> opts.trace_path);
+    free(sim -> opts.daemon_path);
+    free(sim -> opts.arrivals);
+    free(sim -> opts.stop_weights);
+    free(sim -> sink_path);
+    free(sim -> buffer);
+    free(sim);
+}
+
+const char *skibus_scenario(skibus_sim *sim, int L, int Z, int K, int TL, int TB) {
+    // goes through the same checks as the command line
+    int values[5] = {L, Z, K, TL, TB};
+    char text[5][16];
+    char *args[5];
+    for(int i = 0; i < 5; i++) {
+        snprintf(text[i], sizeof(text[i]), "%d", values[i]);
+        args[i] = text[i];
+    }
+    return skibus_scenario_args(sim, args);
+}
+
+const char *skibus_scenario_args(skibus_sim *sim, char *args[]) {
+    // the optimizer always runs coroutines
+    int coro = sim -> opts.engine == ENGINE_CORO || sim -> opts.optimize_us > 0;
+    const char *error = parse_scenario(args, coro ? CORO_MAX_SKIERS : FORK_MAX_SKIERS, &sim -> sc);
+    sim -> scenario_set = (error == NULL);
+    return error;
+}
+
+const char *skibus_backend(skibus_sim *sim, int backend) {
+    if(backend != SKIBUS_FORK && backend != SKIBUS_CORO) {
+        return "Unknown backend.";
+    }
+    sim -> opts.engine = backend;
+    return NULL;
+}
+
+// replaces the string option with a copy of value, returns the copy (NULL = out of memory)
+static char *option_string(char **option, const char *value) {
+    char *copy = strdup(value);
+    if(copy != NULL) {
+        free(*option);
+        *option = copy;
+    }
+    return copy;
+}
+
+const char *skibus_option(skibus_sim *sim, const char *name, const char *value) {
+    options *opts = &sim -> opts;
+    char *optend = ""; // for the strtol function
+    long number = 0;
+    if(value != NULL) {
+        number = strtol(value, &optend, 10);
+    }
+    // a number has to be given and has to be all digits
+    int invalid = value == NULL || strlen(optend) > 0;
+    // options without a value
+    if(strcmp(name, "stats") == 0) {
+        opts -> stats = 1;
+        return NULL;
+    }
+    if(strcmp(name, "express") == 0) {
+        opts -> express = 1;
+        return NULL;
+    }
+    if(value == NULL) {
+        snprintf(sim -> error, sizeof(sim -> error), "Option %s needs an argument.", name);
+        return sim -> error;
+    }
+    // options with a string value
+    char **string = NULL;
+    if(strcmp(name, "engine") == 0) {
+        if(strcmp(value, "fork") == 0) {
+            return skibus_backend(sim, SKIBUS_FORK);
+        }
+        if(strcmp(value, "coro") == 0) {
+            return skibus_backend(sim, SKIBUS_CORO);
+        }
+        snprintf(sim -> error, sizeof(sim -> error), "Unknown engine %s.", value);
+        return sim -> error;
+    }
+    else if(strcmp(name, "trace-json") == 0) {
+        string = &opts -> trace_path;
+    }
+    else if(strcmp(name, "daemon") == 0) {
+        string = &opts -> daemon_path;
+    }
+    else if(strcmp(name, "arrivals") == 0) {
+        string = &opts -> arrivals;
+    }
+    else if(strcmp(name, "stop-weights") == 0) {
+        string = &opts -> stop_weights;
+    }
+    if(string != NULL) {
+        return (option_string(string, value) == NULL) ? "Memory allocation failed." : NULL;
+    }
+    // options with a number
+    if(strcmp(name, "runs") == 0) {
+        if(invalid || number < 1 || number > INT_MAX) {
+            return "Invalid runs argument.";
+        }
+        opts -> runs = number;
+        sim -> runs_set = 1;
+    }
+    else if(strcmp(name, "duration") == 0) {
+        if(invalid || number < 1 || number > INT_MAX) {
+            return "Invalid duration argument.";
+        }
+        opts -> duration = number;
+    }
+    else if(strcmp(name, "jobs") == 0) {
+        if(invalid || number < 1 || number > DAEMON_MAX_JOBS) {
+            return "Invalid jobs argument.";
+        }
+        opts -> daemon_jobs = number;
+        sim -> jobs_set = 1;
+    }
+    else if(strcmp(name, "pool") == 0) {
+        if(invalid || number < 2 || number > FORK_MAX_SKIERS) {
+            return "Invalid pool argument.";
+        }
+        opts -> daemon_pool = number;
+    }
+    else if(strcmp(name, "routes") == 0) {
+        if(invalid || number < 1 || number > MAX_ROUTES) {
+            return "Invalid routes argument.";
+        }
+        opts -> routes = number;
+    }
+    else if(strcmp(name, "optimize") == 0) {
+        if(invalid || number < 1 || number > INT_MAX) {
+            return "Invalid optimize argument.";
+        }
+        opts -> optimize_us = number;
+    }
+    else if(strcmp(name, "replicas") == 0) {
+        if(invalid || number < 1 || number > OPTIMIZE_MAX_REPLICAS) {
+            return "Invalid replicas argument.";
+        }
+        opts -> replicas = number;
+    }
+    else if(strcmp(name, "stall-timeout") == 0) {
+        if(invalid || number < 0 || number > INT_MAX) {
+            return "Invalid stall timeout argument.";
+        }
+        opts -> stall_ms = number;
+    }
+    else {
+        snprintf(sim -> error, sizeof(sim -> error), "Unknown option %s.", name);
+        return sim -> error;
+    }
+    return NULL;
+}
+
+const char *skibus_sink_file(skibus_sim *sim, const char *path) {
+    if(option_string(&sim -> sink_path, path) == NULL) {
+        return "Memory allocation failed.";
+    }
+    sim -> sink = SINK_FILE;
+    return NULL;
+}
+
+void skibus_sink_callback(skibus_sim *sim, skibus_event_fn callback, void *context) {
+    sim -> sink = SINK_CALLBACK;
+    sim -> callback = callback;
+    sim -> context = context;
+}
+
+void skibus_sink_buffer(skibus_sim *sim) {
+    sim -> sink = SINK_BUFFER;
+}
+
+const char *skibus_buffer(skibus_sim *sim, size_t *length) {
+    if(length != NULL) {
+        *length = sim -> buffer_length;
+    }
+    return (sim -> buffer != NULL) ? sim -> buffer : "";
+}
+
+const char *skibus_run(skibus_sim *sim) {
+    options *opts = &sim -> opts;
+    scenario *sc = &sim -> sc;
+    if(active_sim != NULL) {
+        return "Another simulation is running.";
+    }
+    if(!sim -> scenario_set) {
+        return "No scenario has been set.";
+    }
+    // the backend may have changed since the scenario was set
+    if(opts -> engine == ENGINE_FORK && sc -> L >= FORK_MAX_SKIERS) {
+        return "L value is out of range!";
+    }
+    // with only a duration, skiers keep going until it is over
+    int runs = (opts -> duration > 0 && !sim -> runs_set) ? 0 : opts -> runs;
+    // transfers are only modelled for a single trip of every skier in processes
+    if(opts -> routes > 1 && opts -> engine != ENGINE_FORK) {
+        return "Routes need the fork engine.";
+    }
+    if(opts -> routes > 1 && (runs != 1 || opts -> duration > 0)) {
+        return "Routes cannot be combined with runs or duration.";
+    }
+    // every route writes a file of its own
+    if(opts -> routes > 1 && (sim -> sink == SINK_CALLBACK || sim -> sink == SINK_BUFFER)) {
+        return "Routes need a file sink.";
+    }
+    const char *error = NULL;
+    memset(stop_weights, 0, sizeof(stop_weights));
+    if(opts -> stop_weights != NULL) {
+        error = stop_weights_parse(opts -> stop_weights, sc -> Z);
+    }
+    arrival_spec arrivals = {ARRIVAL_UNIFORM, 0, {0}, {0}, NULL};
+    if(error == NULL && opts -> arrivals != NULL) {
+        error = arrival_parse(opts -> arrivals, &arrivals);
+    }
+    rand_seed(time(NULL));
+    if(error == NULL) {
+        error = arrival_generate(&arrivals, sc -> L);
+    }
+    if(error != NULL) {
+        return error;
+    }
+    stall_timeout_us = (uint64_t)opts -> stall_ms * 1000;
+
+    sim -> buffer_length = 0;
+    if(sim -> buffer != NULL) {
+        sim -> buffer[0] = '\0';
+    }
+    sim -> sink_failed = 0;
+    // the files are opened before anything is set up, so a bad path fails the run cleanly
+    FILE *files[MAX_ROUTES];
+    error = network_open((sim -> sink == SINK_FILE) ? sim -> sink_path : NULL, opts -> routes, files);
+    if(error == NULL && opts -> trace_path != NULL) {
+        error = trace_open(opts -> trace_path);
+        if(error != NULL) {
+            for(int i = 0; i < opts -> routes; i++) {
+                if(files[i] != NULL) {
+                    fclose(files[i]);
+                }
+            }
+        }
+    }
+    if(error != NULL) {
+        free(arrival_us);
+        arrival_us = NULL;
+        return error;
+    }
+    network_init(sc, opts -> routes, files);
+
+    // initialize shared variables of every route, route 1 stays selected
+    uint64_t start_us = monotonic_us();
+    for(int route = network.count; route >= 1; route--) {
+        route_select(route);
+        shared_reset(sc, start_us);
+        shared_t -> route = route;
+        shared_t -> engine = opts -> engine;
+        shared_t -> express = opts -> express;
+        shared_t -> runs = runs;
+        shared_t -> measure_memory = opts -> stats;
+        if(opts -> duration > 0) {
+            shared_t -> deadline_us = start_us + (uint64_t)opts -> duration * 1000000;
+        }
+    }
+    network_plan(sc);
+
+    active_sim = sim;
+    sim -> engine = opts -> engine;
+    sim -> start_us = start_us;
+    sim -> supervisor = -1;
+    int in_memory = sim -> sink == SINK_CALLBACK || sim -> sink == SINK_BUFFER;
+    if(sim -> engine == ENGINE_FORK) {
+        if(in_memory) {
+            sink_pipe_open(sim);
+        }
+        // the bus and the skiers are children of the supervisor, so waiting for
+        // them never reaps a child of the caller
+        fflush(NULL);
+        sim -> supervisor = fork();
+        if(sim -> supervisor == -1) {
+            fprintf(stderr, "WARNING: Cannot fork the supervisor.\n");
+        }
+        else if(sim -> supervisor == 0) {
+            spawn_stats spawn;
+            int ret = fork_spawn(&spawn);
+            if(ret != SPAWN_FALLBACK) {
+                ret = fork_wait(opts, &spawn, start_us, ret);
+            }
+            fflush(NULL);
+            _exit(ret);
+        }
+        if(in_memory) {
+            sink_pipe_detach();
+        }
+    }
+    if(sim -> engine == ENGINE_CORO && in_memory) {
+        line_sim = sim;
+    }
+    return NULL;
+}
+
+int skibus_wait(skibus_sim *sim) {
+    if(active_sim != sim) {
+        return 1;
+    }
+    int ret = SPAWN_FALLBACK;
+    if(sim -> engine == ENGINE_FORK && sim -> supervisor != -1) {
+        ret = supervisor_wait(sim -> supervisor);
+    }
+    if(sim -> engine == ENGINE_FORK && ret == SPAWN_FALLBACK) {
+        if(network.count > 1) {
+            fprintf(stderr, "ERROR: Routes cannot run as coroutines!\n");
+            run_finish(sim);
+            return 1;
+        }
+        // the supervisor has told why
+        fprintf(stderr, "WARNING: Running the bus and the skiers as coroutines instead.\n");
+        // nobody writes to the pipe any more
+        if(sim -> pipe_fd != -1) {
+            sink_pipe_join(sim);
+            line_sim = sim;
+        }
+        sim -> engine = ENGINE_CORO;
+        shared_t -> engine = ENGINE_CORO;
+    }
+    if(sim -> engine == ENGINE_CORO) {
+        ret = run_coro(&sim -> opts, sim -> start_us);
+    }
+    run_finish(sim);
+    if(sim -> sink_failed && ret == 0) {
+        ret = 1;
+    }
+    return ret;
+}
+
+// releases everything skibus_run() set up
+static void run_finish(skibus_sim *sim) {
+    if(sim -> pipe_fd != -1) {
+        sink_pipe_join(sim);
+    }
+    trace_close();
+    network_destroy();
+    free(arrival_us);
+    arrival_us = NULL;
+    line_sim = NULL;
+    active_sim = NULL;
+}
+
+int skibus_optimize(skibus_sim *sim) {
+    // the defaults filled in here do not stick to the simulation
+    options opts = sim -> opts;
+    if(active_sim != NULL || !sim -> scenario_set || opts.optimize_us == 0) {
+        fprintf(stderr, "ERROR: Nothing to optimize.\n");
+        return 1;
+    }
+    // with only a duration, skiers keep going until it is over
+    if(opts.duration > 0 && !sim -> runs_set) {
+        opts.runs = 0;
+    }
+    // the optimizer simulates single trips on one route in virtual time
+    if(opts.routes > 1 || opts.runs != 1 || opts.duration > 0) {
+        fprintf(stderr, "ERROR: Optimize cannot be combined with routes, runs or duration.\n");
+        return 1;
+    }
+    // replicas run on every CPU unless told otherwise
+    if(!sim -> jobs_set) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        opts.daemon_jobs = (cpus < 1) ? 1 : (cpus > DAEMON_MAX_JOBS) ? DAEMON_MAX_JOBS : cpus;
+    }
+    stall_timeout_us = (uint64_t)opts.stall_ms * 1000;
+    const char *error = NULL;
+    memset(stop_weights, 0, sizeof(stop_weights));
+    if(opts.stop_weights != NULL) {
+        error = stop_weights_parse(opts.stop_weights, sim -> sc.Z);
+    }
+    arrival_spec arrivals = {ARRIVAL_UNIFORM, 0, {0}, {0}, NULL};
+    if(error == NULL && opts.arrivals != NULL) {
+        error = arrival_parse(opts.arrivals, &arrivals);
+    }
+    if(error != NULL) {
+        fprintf(stderr, "ERROR: %s\n", error);
+        return 1;
+    }
+    rand_seed(time(NULL));
+    // the replicas are children of the supervisor, so waiting for them never reaps a child of the caller
+    fflush(NULL);
+    pid_t supervisor = fork();
+    if(supervisor == -1) {
+        fprintf(stderr, "ERROR: fork() failed!\n");
+        return 1;
+    }
+    if(supervisor == 0) {
+        int ret = run_optimize(&opts, &sim -> sc, &arrivals);
+        fflush(NULL);
+        _exit(ret);
+    }
+    return supervisor_wait(supervisor);
+}
+
+// waits for a supervisor process, returns its exit code (1 if it was killed)
+static int supervisor_wait(pid_t pid) {
+    int status;
+    while(waitpid(pid, &status, 0) == -1) {
+        if(errno != EINTR) {
+            return 1;
+        }
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+int skibus_serve(skibus_sim *sim) {
+    if(active_sim != NULL || sim -> opts.daemon_path == NULL) {
+        fprintf(stderr, "ERROR: Nothing to serve.\n");
+        return 1;
+    }
+    return run_daemon(&sim -> opts);
+}
+
+// hands an output line (NUL terminated) to the sink of the simulation
+static void sink_line(skibus_sim *sim, const char *text, size_t length) {
+    if(sim -> sink == SINK_CALLBACK) {
+        sim -> callback(sim -> context, text, length);
+        return;
+    }
+    if(sim -> buffer_length + length + 1 > sim -> buffer_capacity) {
+        size_t capacity = (sim -> buffer_capacity > 0) ? sim -> buffer_capacity : 4096;
+        while(capacity < sim -> buffer_length + length + 1) {
+            capacity *= 2;
+        }
+        char *buffer = realloc(sim -> buffer, capacity);
+        if(buffer == NULL) {
+            if(!sim -> sink_failed) {
+                fprintf(stderr, "ERROR: Memory allocation failed.\n");
+            }
+            sim -> sink_failed = 1;
+            return;
+        }
+        sim -> buffer = buffer;
+        sim -> buffer_capacity = capacity;
+    }
+    memcpy(sim -> buffer + sim -> buffer_length, text, length + 1);
+    sim -> buffer_length += length;
+}
+
+// delivers the lines the processes of a fork run write to the pipe, until all of them have closed it
+static void *sink_reader(void *arg) {
+    skibus_sim *sim = (skibus_sim *)arg;
+    char pending[8192]; // received bytes of lines not delivered yet
+    size_t length = 0;
+    ssize_t received;
+    while((received = read(sim -> pipe_fd, pending + length, sizeof(pending) - length - 1)) != 0) {
+        if(received == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        length += received;
+        size_t start = 0;
+        for(size_t i = 0; i < length; i++) {
+            if(pending[i] == '\n') {
+                char next = pending[i + 1];
+                pending[i + 1] = '\0';
+                sink_line(sim, pending + start, i + 1 - start);
+                pending[i + 1] = next;
+                start = i + 1;
+            }
+        }
+        // a line longer than the buffer is delivered in pieces
+        if(start == 0 && length == sizeof(pending) - 1) {
+            pending[length] = '\0';
+            sink_line(sim, pending, length);
+            start = length;
+        }
+        memmove(pending, pending + start, length - start);
+        length -= start;
+    }
+    close(sim -> pipe_fd);
+    return NULL;
+}
+
+// makes the pipe read by sink_reader() the output file the processes of a fork run inherit
+static void sink_pipe_open(skibus_sim *sim) {
+    int fds[2];
+    if(pipe2(fds, O_CLOEXEC) == -1) {
+        fprintf(stderr, "ERROR: Failed to create a pipe!\n");
+        exit(1);
+    }
+    FILE *file = fdopen(fds[1], "w");
+    if(file == NULL) {
+        fprintf(stderr, "ERROR: File failed to open\n");
+        exit(1);
+    }
+    sim -> pipe_fd = fds[0];
+    if(pthread_create(&sim -> reader, NULL, sink_reader, sim) != 0) {
+        fprintf(stderr, "ERROR: Failed to create a thread!\n");
+        exit(1);
+    }
+    network.files[0] = file;
+    output_file = file;
+}
+
+// closes this process's end of the pipe once the processes have inherited it,
+// so the reader sees the end of the pipe when the last of them exits
+static void sink_pipe_detach() {
+    if(network.files[0] != NULL) {
+        fclose(network.files[0]);
+    }
+    network.files[0] = NULL;
+    output_file = NULL;
+}
+
+// waits until the reader has delivered every line
+static void sink_pipe_join(skibus_sim *sim) {
+    pthread_join(sim -> reader, NULL);
+    sim -> pipe_fd = -1;
+}
+
+// forks the bus of every route and every skier, returns 0, 1 if not every skier could be
+// forked, or SPAWN_FALLBACK if the coroutine engine has to run instead
+static int fork_spawn(spawn_stats *spawn) {
+    int L = shared_t -> L_total;
+    int buses = network.count;
+    *spawn = (spawn_stats){L + buses, spawn_budget(L + buses), 0, 0, 0};
+    // the buses and at least one skier have to fit
+    if(spawn -> budget < buses + 1) {
+        spawn_print_stats(spawn);
+        fprintf(stderr, "WARNING: Only %ld processes fit the process limit and the available memory, %d are needed at least.\n",
+                spawn -> budget, buses + 1);
+        return SPAWN_FALLBACK;
+    }
+    // soak skiers only exit after their last trip, so throttled ones would start after the soak
+    // and it would measure a smaller load than asked for
+    if(soak_enabled() && spawn -> budget < spawn -> wanted) {
+        spawn_print_stats(spawn);
+        fprintf(stderr, "WARNING: Only %ld of %ld processes fit, a soak run needs all of them at once.\n",
+                spawn -> budget, spawn -> wanted);
+        return SPAWN_FALLBACK;
+    }
+    // the processes flush stdio when they leave, which would write the caller's buffered output again
+    fflush(NULL);
+
+    long running = 0; // processes forked and not waited for yet
+    for(int route = 1; route <= buses; route++) {
+        route_select(route);
+        pid_t bus_id = spawn_process(spawn, &running);
+        if(bus_id == -1) {
+            route_select(1);
+            spawn_print_stats(spawn);
+            fprintf(stderr, "WARNING: Cannot fork the bus of route %d.\n", route);
+            // buses of the previous routes finish without skiers
+            if(route > 1) {
+                network_truncate(0);
+                while(wait(NULL) > 0);
+            }
+            return SPAWN_FALLBACK;
+        }
+        else if(bus_id == 0) {
+            bus();
+            process_exit(0);
+        }
+    }
+    route_select(1);
+    int ret = 0;
+    for(int i = 0; i < L; i++) {
+        pid_t skier_id = spawn_process(spawn, &running);
+        if(skier_id == -1) {
+            fprintf(stderr, "ERROR: fork() failed, finishing with %d of %d skiers!\n", i, L);
+            // the buses finish once the skiers already running have gone skiing
+            network_truncate(i);
+            ret = 1;
+            break;
+        }
+        else if(skier_id == 0) {
+            skier(i + 1);
+            process_exit(0);
+        }
+    }
+    return ret;
+}
+
+// waits for the processes of a fork run, returns the exit code of the run (ret = result of fork_spawn())
+static int fork_wait(options *opts, spawn_stats *spawn, uint64_t start_us, int ret) {
+    int L = shared_t -> L_total;
+    // waits for the bus and all skiers so the semaphores outlive them
+    if(soak_enabled()) {
+        pid_t pid;
+        while((pid = waitpid(-1, NULL, WNOHANG)) != -1) {
+            if(pid == 0) {
+                soak_report(0);
+                usleep(SOAK_POLL_US);
+            }
+        }
+        soak_report(1);
+    }
+    while(wait(NULL) > 0);
+    for(int route = 1; route <= network.count; route++) {
+        if(network.routes[route - 1] -> stalled) {
+            ret = EXIT_STALL;
+        }
+    }
+    if(spawn -> failures > 0 || spawn -> throttled > 0 || opts -> stats) {
+        spawn_print_stats(spawn);
+    }
+    if(opts -> stats) {
+        fork_stats(L, start_us);
+    }
+    return ret;
+}
+
+// **********Optimizer**********
+// The optimizer runs the coroutine engine in virtual time: when every
+// coroutine sleeps, the clock jumps to the next wakeup instead of waiting for
+// it. Replicas run in forked processes, one per CPU, and report back through
+// a pipe. For every TB of a coarse grid it bisects K down to the smallest one
+// that meets the SLO, then bisects TB between the best grid value and the next
+// slower one at that K.
+
+// searches the cheapest K and TB that meet the p99 wait, returns the exit code of the program
+static int run_optimize(options *opts, scenario *sc, arrival_spec *arrivals) {
+    uint64_t start_us = monotonic_us();
+    optimize_search search = {*sc, arrivals, opts -> express, opts -> optimize_us, opts -> replicas,
+                              opts -> daemon_jobs, (unsigned int)time(NULL), NULL, 0, 0, 0};
+    long budget = spawn_budget(search.jobs);
+    if(budget < search.jobs) {
+        search.jobs = (budget < 1) ? 1 : budget;
+    }
+
+    // slowest bus first, so the first of equally cheap settings is the slowest one
+    int steps = (sc -> TB > 0) ? OPTIMIZE_TB_STEPS : 1;
+    int grid[OPTIMIZE_TB_STEPS];
+    int lo[OPTIMIZE_TB_STEPS]; // smallest K that may still meet the SLO
+    int hi[OPTIMIZE_TB_STEPS]; // smallest K known to meet it (-1 = none does)
+    int batch[OPTIMIZE_TB_STEPS];
+    for(int i = 0; i < steps; i++) {
+        grid[i] = sc -> TB * (steps - i) / steps;
+        batch[i] = optimize_find(&search, K_MAX, grid[i]);
+    }
+    // the largest capacity tells which bus timings can meet the SLO at all
+    optimize_evaluate(&search, batch, steps);
+    for(int i = 0; i < steps; i++) {
+        lo[i] = K_MIN;
+        hi[i] = optimize_meets(&search, batch[i]) ? K_MAX : -1;
+    }
+    // bisects K for every TB at once, so all of them share the CPUs
+    while(1) {
+        int count = 0;
+        int owner[OPTIMIZE_TB_STEPS];
+        for(int i = 0; i < steps; i++) {
+            if(hi[i] != -1 && lo[i] < hi[i]) {
+                owner[count] = i;
+                batch[count++] = optimize_find(&search, (lo[i] + hi[i]) / 2, grid[i]);
+            }
+        }
+        if(count == 0) {
+            break;
+        }
+        optimize_evaluate(&search, batch, count);
+        for(int j = 0; j < count; j++) {
+            int i = owner[j];
+            if(optimize_meets(&search, batch[j])) {
+                hi[i] = (lo[i] + hi[i]) / 2;
+            }
+            else {
+                lo[i] = (lo[i] + hi[i]) / 2 + 1;
+            }
+        }
+    }
+    int best = -1;
+    for(int i = 0; i < steps; i++) {
+        if(hi[i] != -1 && (best == -1 || hi[i] < hi[best])) {
+            best = i;
+        }
+    }
+    if(best == -1) {
+        optimize_report(&search, -1, start_us);
+        return 1;
+    }
+
+    // the next slower grid TB needs more capacity, the slowest TB that does not lies in between
+    int K = hi[best];
+    int tb_lo = grid[best]; // meets the SLO at K
+    int tb_hi = (best > 0) ? grid[best - 1] : grid[best]; // misses it at K
+    while(tb_hi - tb_lo > 1) {
+        // as many TB values at once as there are CPUs for their replicas
+        int count = search.jobs / search.replicas;
+        count = (count < 1) ? 1 : (count > OPTIMIZE_TB_STEPS) ? OPTIMIZE_TB_STEPS : count;
+        if(count > tb_hi - tb_lo - 1) {
+            count = tb_hi - tb_lo - 1;
+        }
+        for(int j = 0; j < count; j++) {
+            batch[j] = optimize_find(&search, K, tb_lo + (tb_hi - tb_lo) * (j + 1) / (count + 1));
+        }
+        optimize_evaluate(&search, batch, count);
+        int new_lo = tb_lo;
+        for(int j = 0; j < count; j++) {
+            if(optimize_meets(&search, batch[j])) {
+                new_lo = search.points[batch[j]].TB;
+            }
+        }
+        // the first value above the new lower bound that missed becomes the upper bound
+        int new_hi = tb_hi;
+        for(int j = count - 1; j >= 0; j--) {
+            int TB = search.points[batch[j]].TB;
+            if(TB > new_lo && !optimize_meets(&search, batch[j])) {
+                new_hi = TB;
+            }
+        }
+        tb_lo = new_lo;
+        tb_hi = new_hi;
+    }
+    optimize_report(&search, optimize_find(&search, K, tb_lo), start_us);
+    return 0;
+}
+
+// returns the index of the point of the setting, adding it if it has not been tried yet
+static int optimize_find(optimize_search *search, int K, int TB) {
+    for(int i = 0; i < search -> point_count; i++) {
+        if(search -> points[i].K == K && search -> points[i].TB == TB) {
+            return i;
+        }
+    }
+    if(search -> point_count == search -> point_capacity) {
+        int capacity = (search -> point_capacity == 0) ? 64 : search -> point_capacity * 2;
+        optimize_point *points = realloc(search -> points, capacity * sizeof(optimize_point));
+        if(points == NULL) {
+            fprintf(stderr, "ERROR: Memory allocation failed.\n");
+            // the optimizer runs in the supervisor, which leaves with _exit() like every process of the library
+            fflush(NULL);
+            _exit(1);
+        }
+        search -> points = points;
+        search -> point_capacity = capacity;
+    }
+    optimize_point *point = &search -> points[search -> point_count];
+    memset(point, 0, sizeof(optimize_point));
+    point -> K = K;
+    point -> TB = TB;
+    return search -> point_count++;
+}
+
+// runs every replica of the points not tried yet, up to jobs of them at once
+static void optimize_evaluate(optimize_search *search, int *batch, int count) {
+    int tasks = count * search -> replicas;
+    pid_t *pids = calloc(tasks, sizeof(pid_t)); // replica processes not waited for yet (0 = none, < 0 = killed)
+    char *reported = calloc(tasks, 1); // whether the replica has sent its result
+    int result_pipe[2];
+    if(pids == NULL || reported == NULL || pipe2(result_pipe, O_CLOEXEC) == -1
+       || fcntl(result_pipe[0], F_SETFL, O_NONBLOCK) == -1) {
+        fprintf(stderr, "ERROR: Failed to create a pipe!\n");
+        fflush(NULL);
+        _exit(1);
+    }
+    fflush(NULL);
+    int next = 0;
+    int running = 0;
+    while(next < tasks || running > 0) {
+        while(running < search -> jobs && next < tasks) {
+            int task = next++;
+            optimize_point *point = &search -> points[batch[task / search -> replicas]];
+            // a point is tried once, and one missed replica is enough to reject it
+            if(point -> finished + point -> stopped >= search -> replicas) {
+                continue;
+            }
+            if(point -> failed > 0) {
+                point -> stopped++;
+                continue;
+            }
+            pid_t pid = fork();
+            if(pid == -1) {
+                if(running == 0) {
+                    fprintf(stderr, "ERROR: fork() failed!\n");
+                    fflush(NULL);
+                    _exit(1);
+                }
+                // tries again once a replica has finished
+                next--;
+                break;
+            }
+            if(pid == 0) {
+                close(result_pipe[0]);
+                optimize_replica(search, batch[task / search -> replicas], task, result_pipe[1]);
+                _exit(0);
+            }
+            pids[task] = pid;
+            running++;
+            search -> runs++;
+        }
+        if(running == 0) {
+            continue;
+        }
+        pid_t pid = wait(NULL);
+        if(pid == -1) {
+            break;
+        }
+        running--;
+        optimize_collect(search, batch, reported, result_pipe[0]);
+        for(int task = 0; task < tasks; task++) {
+            optimize_point *point = &search -> points[batch[task / search -> replicas]];
+            if(pids[task] == pid || pids[task] == -pid) {
+                // killed, or crashed without a result
+                if(!reported[task]) {
+                    point -> stopped++;
+                    point -> failed += (pids[task] > 0);
+                }
+                pids[task] = 0;
+            }
+            // the other replicas of a rejected point are not needed any more
+            else if(pids[task] > 0 && point -> failed > 0) {
+                kill(pids[task], SIGKILL);
+                pids[task] = -pids[task];
+            }
+        }
+    }
+    close(result_pipe[0]);
+    close(result_pipe[1]);
+    free(reported);
+    free(pids);
+}
+
+// adds the results the replicas have sent so far to their points
+static void optimize_collect(optimize_search *search, int *batch, char *reported, int fd) {
+    optimize_result result;
+    // results are smaller than PIPE_BUF, so every read gets a whole one
+    while(read(fd, &result, sizeof(result)) == sizeof(result)) {
+        optimize_point *point = &search -> points[batch[result.task / search -> replicas]];
+        reported[result.task] = 1;
+        if(result.stopped) {
+            point -> stopped++;
+        }
+        else {
+            point -> finished++;
+            if(result.p99_us > point -> p99_us) {
+                point -> p99_us = result.p99_us;
+            }
+        }
+        if(!result.meets) {
+            point -> failed++;
+        }
+    }
+}
+
+// runs one replica of the point in virtual time and sends its result (in a forked process)
+static void optimize_replica(optimize_search *search, int index, int task, int fd) {
+    int replica = task % search -> replicas;
+    scenario sc = search -> sc;
+    sc.K = search -> points[index].K;
+    sc.TB = search -> points[index].TB;
+    struct_init(sc.Z, NULL);
+    // every replica draws its own arrivals and times, the same ones for every point
+    rand_seed(search -> seed + replica);
+    if(arrival_generate(search -> arrivals, sc.L) != NULL) {
+        _exit(1);
+    }
+    virtual_us = monotonic_us();
+    shared_reset(&sc, virtual_us);
+    shared_t -> engine = ENGINE_CORO;
+    shared_t -> express = search -> express;
+    // the p99 wait is over the SLO once more than 1% of the waits are
+    slo_us = search -> slo_us;
+    slo_budget = sc.L - (99L * sc.L + 99) / 100;
+    slo_waits = malloc(sc.L * sizeof(uint64_t));
+    if(slo_waits == NULL) {
+        _exit(1);
+    }
+
+    co_init();
+    // a deadlocked replica reports nothing, like a crashed one
+    if(co_run() != 0) {
+        _exit(EXIT_STALL);
+    }
+    optimize_result result = {task, slo_budget >= 0, slo_budget < 0, 0};
+    if(!result.stopped && slo_wait_count > 0) {
+        qsort(slo_waits, slo_wait_count, sizeof(uint64_t), compare_u64);
+        result.p99_us = slo_waits[(99 * slo_wait_count + 99) / 100 - 1];
+    }
+    if(write(fd, &result, sizeof(result)) != sizeof(result)) {
+        _exit(1);
+    }
+    co_destroy();
+    struct_destroy();
+}
+
+// counts a wait that is over the SLO of an optimizer replica
+static void optimize_record_wait(uint64_t us) {
+    if(slo_us == 0) {
+        return;
+    }
+    slo_waits[slo_wait_count++] = us;
+    if(us > slo_us) {
+        slo_budget--;
+    }
+}
+
+// returns 1 if every replica of the point met the SLO
+static int optimize_meets(optimize_search *search, int index) {
+    optimize_point *point = &search -> points[index];
+    return point -> failed == 0 && point -> finished == search -> replicas;
+}
+
+// prints the cheapest setting (best = its point, -1 = none) and the Pareto frontier of K against p99 wait
+static void optimize_report(optimize_search *search, int best, uint64_t start_us) {
+    long stopped = 0;
+    for(int i = 0; i < search -> point_count; i++) {
+        stopped += search -> points[i].stopped;
+    }
+    printf("optimize: L %d, Z %d, TL %d, p99 wait SLO %llu us, %d replicas, %d jobs\n",
+           search -> sc.L, search -> sc.Z, search -> sc.TL, (unsigned long long)search -> slo_us,
+           search -> replicas, search -> jobs);
+    printf("tried %d settings, %ld replicas (%ld stopped early) in %.3f s\n",
+           search -> point_count, search -> runs, stopped, (monotonic_us() - start_us) / 1e6);
+    if(best == -1) {
+        printf("cheapest: none, K %d misses the SLO for every TB up to %d\n", K_MAX, search -> sc.TB);
+    }
+    else {
+        printf("cheapest: K %d TB %d (p99 wait %llu us)\n", search -> points[best].K, search -> points[best].TB,
+               (unsigned long long)search -> points[best].p99_us);
+    }
+
+    // settings whose p99 wait is lower than that of every setting with less capacity
+    printf("pareto frontier (capacity against p99 wait of settings that ran to the end):\n");
+    printf("%4s %5s %10s %s\n", "K", "TB", "p99_us", "slo");
+    uint64_t frontier_us = UINT64_MAX;
+    for(int K = K_MIN; K <= K_MAX; K++) {
+        int point = -1;
+        for(int i = 0; i < search -> point_count; i++) {
+            optimize_point *candidate = &search -> points[i];
+            if(candidate -> K != K || candidate -> finished != search -> replicas) {
+                continue;
+            }
+            // the slower bus is cheaper among equal waits
+            if(point == -1 || candidate -> p99_us < search -> points[point].p99_us
+               || (candidate -> p99_us == search -> points[point].p99_us && candidate -> TB > search -> points[point].TB)) {
+                point = i;
+            }
+        }
+        if(point != -1 && search -> points[point].p99_us < frontier_us) {
+            frontier_us = search -> points[point].p99_us;
+            printf("%4d %5d %10llu %s\n", K, search -> points[point].TB, (unsigned long long)frontier_us,
+                   optimize_meets(search, point) ? "met" : "missed");
+        }
+    }
+    free(search -> points);
+}
+
+// **********Arrivals**********
+
+// parses an arrival process (uniform, poisson:RATE, mmpp:RATE:SECONDS,RATE:SECONDS,
+// profile:RATE:SECONDS,... or replay:FILE), returns an error message or NULL
+static const char *arrival_parse(char *text, arrival_spec *spec) {
+    char *params = strchr(text, ':');
+    if(strcmp(text, "uniform") == 0) {
+        spec -> kind = ARRIVAL_UNIFORM;
+        return NULL;
+    }
+    if(params == NULL) {
+        return "Invalid arrivals argument.";
+    }
+    params++;
+    if(strncmp(text, "replay:", 7) == 0) {
+        spec -> kind = ARRIVAL_REPLAY;
+        spec -> path = params;
+        return NULL;
+    }
+    if(strncmp(text, "poisson:", 8) == 0) {
+        spec -> kind = ARRIVAL_POISSON;
+    }
+    else if(strncmp(text, "mmpp:", 5) == 0) {
+        spec -> kind = ARRIVAL_MMPP;
+    }
+    else if(strncmp(text, "profile:", 8) == 0) {
+        spec -> kind = ARRIVAL_PROFILE;
+    }
+    else {
+        return "Invalid arrivals argument.";
+    }
+
+    // RATE[:SECONDS] pairs separated by commas
+    char *endptr = params;
+    double busiest = 0;
+    spec -> segments = 0;
+    do {
+        if(spec -> segments == MAX_PROFILE_SEGMENTS) {
+            return "Too many arrival rates.";
+        }
+        double rate = strtod(endptr, &endptr);
+        double length = HUGE_VAL;
+        if(*endptr == ':' && spec -> kind != ARRIVAL_POISSON) {
+            length = strtod(endptr + 1, &endptr);
+        }
+        else if(spec -> kind != ARRIVAL_POISSON) {
+            return "Invalid arrivals argument.";
+        }
+        if(!(rate >= 0) || !(length > 0)) {
+            return "Invalid arrivals argument.";
+        }
+        spec -> rates[spec -> segments] = rate;
+        spec -> lengths[spec -> segments] = length;
+        spec -> segments++;
+        busiest = (rate > busiest) ? rate : busiest;
+    } while(*endptr++ == ',' && spec -> kind != ARRIVAL_POISSON);
+    if(*(endptr - 1) != '\0') {
+        return "Invalid arrivals argument.";
+    }
+    if((spec -> kind == ARRIVAL_MMPP && spec -> segments != 2) || busiest == 0) {
+        return "Invalid arrivals argument.";
+    }
+    return NULL;
+}
+
+// generates the first arrival of every skier, returns an error message or NULL
+static const char *arrival_generate(arrival_spec *spec, int L) {
+    // arrivals of an earlier run are never used again
+    free(arrival_us);
+    arrival_us = NULL;
+    if(spec -> kind == ARRIVAL_UNIFORM) {
+        return NULL;
+    }
+    arrival_us = malloc(L * sizeof(uint64_t));
+    if(arrival_us == NULL) {
+        return "Memory allocation failed.";
+    }
+    if(spec -> kind == ARRIVAL_REPLAY) {
+        const char *error = arrival_replay(spec -> path, L);
+        // a failed run leaves uniform sleeps behind, not half read arrivals
+        if(error != NULL) {
+            free(arrival_us);
+            arrival_us = NULL;
+        }
+        return error;
+    }
+    double now = 0; // seconds since the start
+    int segment = 0;
+    // MMPP stays in a state for an exponential time, a profile for the segment's length
+    double segment_end = (spec -> kind == ARRIVAL_MMPP) ? arrival_gap(1 / spec -> lengths[0]) : spec -> lengths[0];
+    for(int i = 0; i < L; i++) {
+        while(1) {
+            double rate = spec -> rates[segment];
+            if(rate > 0) {
+                double gap = arrival_gap(rate);
+                if(now + gap < segment_end) {
+                    now += gap;
+                    break;
+                }
+            }
+            // the rate changes before the next arrival, gaps are memoryless so the next one starts over
+            now = segment_end;
+            segment = (segment + 1) % spec -> segments;
+            segment_end += (spec -> kind == ARRIVAL_MMPP) ? arrival_gap(1 / spec -> lengths[segment]) : spec -> lengths[segment];
+        }
+        arrival_us[i] = (uint64_t)(now * 1e6);
+    }
+    return NULL;
+}
+
+// reads recorded arrival times in seconds (one per line) and gives the earliest L to the skiers
+static const char *arrival_replay(const char *path, int L) {
+    FILE *file = fopen(path, "r");
+    if(file == NULL) {
+        return "Replay file failed to open.";
+    }
+    size_t count = 0;
+    size_t capacity = L;
+    double *times = malloc(capacity * sizeof(double));
+    char line[128];
+    while(times != NULL && fgets(line, sizeof(line), file) != NULL) {
+        char *endptr;
+        double time = strtod(line, &endptr);
+        // empty lines and comments
+        if(endptr == line) {
+            continue;
+        }
+        if(count == capacity) {
+            capacity *= 2;
+            double *bigger = realloc(times, capacity * sizeof(double));
+            if(bigger == NULL) {
+                free(times);
+                times = NULL;
+                break;
+            }
+            times = bigger;
+        }
+        times[count++] = time;
+    }
+    fclose(file);
+    if(times == NULL) {
+        return "Memory allocation failed.";
+    }
+    if(count < (size_t)L) {
+        free(times);
+        return "Replay file has fewer arrivals than skiers.";
+    }
+    // the recording may start at any time of day
+    qsort(times, count, sizeof(double), compare_double);
+    for(int i = 0; i < L; i++) {
+        arrival_us[i] = (uint64_t)((times[i] - times[0]) * 1e6);
+    }
+    free(times);
+    return NULL;
+}
+
+// returns an exponentially distributed gap in seconds between arrivals at the rate
+static double arrival_gap(double rate) {
+    double uniform = (rand_next() + 1.0) / (RAND_MAX + 2.0);
+    return -log(uniform) / rate;
+}
+
+// returns how many micro seconds the skier has left until its first arrival
+static int arrival_delay(int position) {
+    uint64_t at = shared_t -> start_us + arrival_us[position - 1];
+    uint64_t now = monotonic_us();
+    if(now >= at) {
+        return 0;
+    }
+    return (at - now > INT_MAX) ? INT_MAX : (int)(at - now);
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// parses the popularity of each of the Z stops (W1,...,WZ), returns an error message or NULL
+static const char *stop_weights_parse(char *text, int Z) {
+    char *endptr = text;
+    int total = 0;
+    for(int i = 0; i < Z; i++) {
+        long weight = strtol(endptr, &endptr, 10);
+        if(weight < 0 || weight > 1000 || *endptr != ((i == Z - 1) ? '\0' : ',')) {
+            return "Invalid stop weights, Z weights from 0 to 1000 expected.";
+        }
+        endptr++;
+        total += weight;
+        stop_weights[i] = total;
+    }
+    if(total == 0) {
+        return "Invalid stop weights, Z weights from 0 to 1000 expected.";
+    }
+    return NULL;
+}
+
+// returns the stop a skier goes to for the random number
+static int stop_pick() {
+    // forked skiers inherit one seed, the pid keeps them from picking the same stops
+    unsigned int random = (unsigned int)rand_next() + getpid();
+    // the last cumulative weight is the total
+    if(stop_weights[shared_t -> Z_count - 1] == 0) {
+        return (random % (shared_t -> Z_count)) + 1;
+    }
+    unsigned int pick = random % stop_weights[shared_t -> Z_count - 1];
+    int stop = 0;
+    while((unsigned int)stop_weights[stop] <= pick) {
+        stop++;
+    }
+    return stop + 1;
+}
+
+// runs the bus and every skier as a coroutine, returns the exit code of the program
+static int run_coro(options *opts, uint64_t start_us) {
+    co_init();
+    int ret = co_run();
+    trace_flush();
+    if(soak_enabled()) {
+        soak_report(1);
+    }
+    if(opts -> stats) {
+        co_stats(start_us);
+    }
+    co_destroy();
+    return ret;
+}
+
+// **********Route network**********
+
+// opens the output file of every route (path of route 1 of 1, NULL = no files), returns an error message or NULL
+static const char *network_open(const char *path, int count, FILE *files[]) {
+    // PATH.out becomes PATH.R.out, any other PATH becomes PATH.R
+    size_t stem = (path != NULL) ? strlen(path) : 0;
+    if(stem >= 4 && strcmp(path + stem - 4, ".out") == 0) {
+        stem -= 4;
+    }
+    for(int i = 0; i < count; i++) {
+        files[i] = NULL;
+        if(path == NULL) {
+            continue;
+        }
+        char route_path[PATH_MAX];
+        if(count == 1) {
+            snprintf(route_path, sizeof(route_path), "%s", path);
+        }
+        else {
+            snprintf(route_path, sizeof(route_path), "%.*s.%d%s", (int)stem, path, i + 1, path + stem);
+        }
+        files[i] = fopen(route_path, "w");
+        if(files[i] == NULL) {
+            while(i-- > 0) {
+                fclose(files[i]);
+            }
+            return "Output file failed to open.";
+        }
+    }
+    return NULL;
+}
+
+// maps the shard of every route, the output files come from network_open()
+static void network_init(scenario *sc, int count, FILE *files[]) {
+    memset(&network, 0, sizeof(route_network));
+    network.count = count;
+    if(count == 1) {
+        struct_init(sc -> Z, files[0]);
+        network.routes[0] = shared_t;
+        network.files[0] = output_file;
+        return;
+    }
+    // enough cells that a push never finds the queue full
+    size_t cells = 2;
+    while(cells < (size_t)sc -> L) {
+        cells *= 2;
+    }
+    for(int i = 0; i < count; i++) {
+        struct_init(sc -> Z, files[i]);
+        network.routes[i] = shared_t;
+        network.files[i] = output_file;
+        if(i == 0) {
+            continue;
+        }
+        size_t size = sizeof(hub_queue) + cells * sizeof(hub_cell);
+        hub_queue *hub = (hub_queue *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if(hub == MAP_FAILED) {
+            fprintf(stderr, "ERROR: Memory mapping failed.\n");
+            network_destroy();
+            exit(1);
+        }
+        hub -> mask = cells - 1;
+        for(size_t j = 0; j < cells; j++) {
+            hub -> cells[j].seq = j;
+        }
+        network.routes[i] -> hub_in = hub;
+    }
+    network.journeys = malloc(sc -> L * sizeof(*network.journeys));
+    if(network.journeys == NULL) {
+        fprintf(stderr, "ERROR: Memory allocation failed.\n");
+        network_destroy();
+        exit(1);
+    }
+    cpu_set_t allowed;
+    if(sched_getaffinity(0, sizeof(cpu_set_t), &allowed) == 0) {
+        for(int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if(CPU_ISSET(cpu, &allowed)) {
+                network.cpus[network.cpu_count++] = cpu;
+            }
+        }
+    }
+}
+
+// chooses the routes every skier rides and counts the riders of every route
+static void network_plan(scenario *sc) {
+    if(network.count == 1) {
+        return;
+    }
+    for(int i = 0; i < sc -> L; i++) {
+        // a skier starts anywhere and goes on to the next route at every other hub
+        int first = rand_next() % network.count + 1;
+        int last = first;
+        while(last < network.count && rand_next() % 2 == 0) {
+            last++;
+        }
+        network.journeys[i][0] = first;
+        network.journeys[i][1] = last;
+    }
+    network_truncate(sc -> L);
+}
+
+// makes every bus wait only for the first skiers of the network
+static void network_truncate(int skiers) {
+    if(network.count == 1) {
+        __atomic_store_n(&network.routes[0] -> L_count, skiers, __ATOMIC_SEQ_CST);
+        return;
+    }
+    int riders[MAX_ROUTES] = {0};
+    for(int i = 0; i < skiers; i++) {
+        for(int route = network.journeys[i][0]; route <= network.journeys[i][1]; route++) {
+            riders[route - 1]++;
+        }
+    }
+    for(int i = 0; i < network.count; i++) {
+        __atomic_store_n(&network.routes[i] -> L_count, riders[i], __ATOMIC_SEQ_CST);
+    }
+}
+
+// unmaps the shards and closes the output files of all routes
+static void network_destroy() {
+    for(int i = network.count - 1; i >= 0; i--) {
+        if(network.routes[i] == NULL) {
+            continue;
+        }
+        hub_queue *hub = network.routes[i] -> hub_in;
+        if(hub != NULL) {
+            munmap(hub, sizeof(hub_queue) + (hub -> mask + 1) * sizeof(hub_cell));
+        }
+        shared_t = network.routes[i];
+        output_file = network.files[i];
+        struct_destroy();
+    }
+    free(network.journeys);
+    memset(&network, 0, sizeof(route_network));
+}
+
+// makes the route's shard and output file the ones this process works with
+static void route_select(int route) {
+    shared_t = network.routes[route - 1];
+    output_file = network.files[route - 1];
+}
+
+// keeps this process on the CPU of its route, so a shard stays in one CPU's cache
+static void route_pin(int route) {
+    if(network.count == 1 || network.cpu_count == 0) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(network.cpus[(route - 1) % network.cpu_count], &set);
+    // the scheduler places the process itself if pinning is not allowed
+    sched_setaffinity(0, sizeof(cpu_set_t), &set);
+}
+
+// hands the skier over to the bus of the hub's route without blocking
+static void hub_push(hub_queue *hub, int skier) {
+    uint64_t pos = __atomic_load_n(&hub -> tail, __ATOMIC_RELAXED);
+    while(1) {
+        hub_cell *cell = &hub -> cells[pos & hub -> mask];
+        uint64_t seq = __atomic_load_n(&cell -> seq, __ATOMIC_ACQUIRE);
+        if(seq == pos) {
+            // the cell is free, claims it against the other skiers
+            if(__atomic_compare_exchange_n(&hub -> tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                cell -> skier = skier;
+                __atomic_store_n(&cell -> seq, pos + 1, __ATOMIC_RELEASE);
+                return;
+            }
+        }
+        else {
+            // another skier took the position (the queue has a cell for every skier, so it is never full)
+            pos = __atomic_load_n(&hub -> tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// takes every skier pushed to the hub so far, returns their count
+static int hub_drain(hub_queue *hub) {
+    int count = 0;
+    uint64_t pos = hub -> head;
+    while(1) {
+        hub_cell *cell = &hub -> cells[pos & hub -> mask];
+        // a skier that claimed the cell but has not written it yet waits for the next lap
+        if(__atomic_load_n(&cell -> seq, __ATOMIC_ACQUIRE) != pos + 1) {
+            break;
+        }
+        __atomic_store_n(&cell -> seq, pos + hub -> mask + 1, __ATOMIC_RELEASE);
+        pos++;
+        count++;
+    }
+    __atomic_store_n(&hub -> head, pos, __ATOMIC_RELEASE);
+    return count;
+}
+
+// returns 1 if skiers have been pushed to the hub and not taken yet
+static int hub_pending(hub_queue *hub) {
+    return __atomic_load_n(&hub -> tail, __ATOMIC_ACQUIRE) != __atomic_load_n(&hub -> head, __ATOMIC_ACQUIRE);
+}
+
+// **********Daemon**********
+
+// serves scenario requests from the UNIX socket until SIGINT/SIGTERM, returns the exit code of the program
+static int run_daemon(options *opts) {
+    // a stalled job is answered with an error and its pool gets new workers
+    stall_timeout_us = (uint64_t)opts -> stall_ms * 1000;
+    // the pools have to fit into the process budget
+    int pool_size = opts -> daemon_pool;
+    long budget = spawn_budget((long)opts -> daemon_jobs * pool_size);
+    if(budget / opts -> daemon_jobs < pool_size) {
+        pool_size = budget / opts -> daemon_jobs;
+        if(pool_size < 2) {
+            fprintf(stderr, "ERROR: Not enough processes for %d pools!\n", opts -> daemon_jobs);
+            return 1;
+        }
+        fprintf(stderr, "WARNING: Pools limited to %d workers.\n", pool_size);
+    }
+
+    // finished pools write their index here
+    int done_pipe[2];
+    if(pipe2(done_pipe, O_CLOEXEC) == -1 || fcntl(done_pipe[0], F_SETFL, O_NONBLOCK) == -1) {
+        fprintf(stderr, "ERROR: Failed to create a pipe!\n");
+        return 1;
+    }
+    daemon_slot *slots = calloc(opts -> daemon_jobs, sizeof(daemon_slot));
+    if(slots == NULL) {
+        fprintf(stderr, "ERROR: Memory allocation failed.\n");
+        return 1;
+    }
+    int ret = 0;
+    int slot_count = 0;
+    for(; slot_count < opts -> daemon_jobs; slot_count++) {
+        if(pool_init(&slots[slot_count], slot_count, pool_size, done_pipe[1]) == -1) {
+            ret = 1;
+            break;
+        }
+    }
+
+    int listen_fd = -1;
+    int epoll_fd = -1;
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if(ret == 0) {
+        if(strlen(opts -> daemon_path) >= sizeof(address.sun_path)) {
+            fprintf(stderr, "ERROR: Socket path is too long!\n");
+            ret = 1;
+        }
+        else {
+            strcpy(address.sun_path, opts -> daemon_path);
+            unlink(opts -> daemon_path);
+            listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+            epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+            if(listen_fd == -1 || epoll_fd == -1
+               || bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) == -1
+               || listen(listen_fd, SOMAXCONN) == -1) {
+                fprintf(stderr, "ERROR: Failed to listen on %s!\n", opts -> daemon_path);
+                ret = 1;
+            }
+        }
+    }
+    // the listening socket and the pipe are told apart from clients by these addresses
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = &listen_fd};
+    if(ret == 0 && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) == -1) {
+        ret = 1;
+    }
+    event.data.ptr = &done_pipe[0];
+    if(ret == 0 && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, done_pipe[0], &event) == -1) {
+        ret = 1;
+    }
+
+    struct sigaction action = {.sa_handler = daemon_signal};
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    if(ret == 0) {
+        fprintf(stderr, "daemon: listening on %s, %d jobs at once, %d workers each\n",
+                opts -> daemon_path, slot_count, pool_size);
+    }
+
+    daemon_job *queue_head = NULL; // jobs waiting for a pool
+    daemon_job *queue_tail = NULL;
+    int job_id = 0;
+    while(ret == 0 && !daemon_stopping) {
+        struct epoll_event events[16];
+        int ready = epoll_wait(epoll_fd, events, 16, -1);
+        if(ready == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "ERROR: epoll_wait() failed!\n");
+            ret = 1;
+            break;
+        }
+        for(int i = 0; i < ready; i++) {
+            if(events[i].data.ptr == &listen_fd) {
+                int client_fd;
+                while((client_fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK)) != -1) {
+                    daemon_client *client = malloc(sizeof(daemon_client));
+                    if(client == NULL) {
+                        close(client_fd);
+                        continue;
+                    }
+                    client -> fd = client_fd;
+                    client -> length = 0;
+                    struct epoll_event client_event = {.events = EPOLLIN, .data.ptr = client};
+                    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &client_event) == -1) {
+                        close(client_fd);
+                        free(client);
+                    }
+                }
+            }
+            else if(events[i].data.ptr == &done_pipe[0]) {
+                int slot;
+                // the read end does not block, so this stops once the pipe is empty
+                while(read(done_pipe[0], &slot, sizeof(slot)) == sizeof(slot)) {
+                    daemon_finish_job(&slots[slot]);
+                    // the workers of a stalled job are stuck or gone
+                    if(slots[slot].shared -> stalled
+                       && pool_respawn(&slots[slot], slot, pool_size, done_pipe[1]) == -1) {
+                        ret = 1;
+                    }
+                }
+            }
+            else {
+                daemon_read(events[i].data.ptr, epoll_fd, pool_size, &queue_head, &queue_tail, &job_id);
+            }
+        }
+        // hands queued jobs to idle pools
+        for(int i = 0; i < slot_count && queue_head != NULL; i++) {
+            if(slots[i].job != NULL) {
+                continue;
+            }
+            daemon_job *job = queue_head;
+            queue_head = job -> next;
+            if(queue_head == NULL) {
+                queue_tail = NULL;
+            }
+            if(daemon_start_job(&slots[i], job) == -1) {
+                // the pool stays idle for the next job
+                i--;
+            }
+        }
+    }
+
+    // clients that still wait for a reply only see their connection close
+    while(queue_head != NULL) {
+        daemon_job *job = queue_head;
+        queue_head = job -> next;
+        close(job -> client);
+        free(job);
+    }
+    for(int i = 0; i < slot_count; i++) {
+        if(slots[i].job != NULL) {
+            close(slots[i].job -> client);
+            free(slots[i].job);
+        }
+        pool_destroy(&slots[i]);
+    }
+    free(slots);
+    close(done_pipe[0]);
+    close(done_pipe[1]);
+    if(epoll_fd != -1) {
+        close(epoll_fd);
+    }
+    if(listen_fd != -1) {
+        close(listen_fd);
+        unlink(opts -> daemon_path);
+    }
+    return ret;
+}
+
+// maps the shared variables of a pool and forks its workers, returns -1 on failure
+static int pool_init(daemon_slot *slot, int index, int size, int done_fd) {
+    memset(slot, 0, sizeof(daemon_slot));
+    struct_init(MAX_STOPS, NULL);
+    shared_t -> Z_count = MAX_STOPS;
+    slot -> shared = shared_t;
+    slot -> pool = (pool_shared *)mmap(NULL, sizeof(pool_shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(slot -> pool == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Memory mapping failed.\n");
+        slot -> pool = NULL;
+        pool_destroy(slot);
+        return -1;
+    }
+    if(sem_init(&slot -> pool -> tasks, 1, 0) == -1) {
+        fprintf(stderr, "ERROR: Failed to initialize a semaphore!\n");
+        pool_destroy(slot);
+        return -1;
+    }
+    slot -> workers = calloc(size, sizeof(pid_t));
+    if(slot -> workers == NULL) {
+        fprintf(stderr, "ERROR: Memory allocation failed.\n");
+        pool_destroy(slot);
+        return -1;
+    }
+    if(pool_fork(slot, index, size, done_fd) == -1) {
+        pool_destroy(slot);
+        return -1;
+    }
+    return 0;
+}
+
+// forks the workers of a pool up to size, returns -1 on failure
+static int pool_fork(daemon_slot *slot, int index, int size, int done_fd) {
+    while(slot -> worker_count < size) {
+        pid_t pid = fork();
+        if(pid == -1) {
+            fprintf(stderr, "ERROR: fork() failed!\n");
+            return -1;
+        }
+        else if(pid == 0) {
+            pool_worker(slot, index, done_fd);
+        }
+        slot -> workers[slot -> worker_count++] = pid;
+    }
+    return 0;
+}
+
+// replaces the workers of a pool whose job stalled, returns -1 on failure
+static int pool_respawn(daemon_slot *slot, int index, int size, int done_fd) {
+    // a stuck worker may not even run to handle SIGTERM
+    for(int i = 0; i < slot -> worker_count; i++) {
+        kill(slot -> workers[i], SIGKILL);
+    }
+    for(int i = 0; i < slot -> worker_count; i++) {
+        waitpid(slot -> workers[i], NULL, 0);
+    }
+    slot -> worker_count = 0;
+    // tasks of the stalled job that nobody took are dropped
+    sem_destroy(&slot -> pool -> tasks);
+    if(sem_init(&slot -> pool -> tasks, 1, 0) == -1) {
+        fprintf(stderr, "ERROR: Failed to initialize a semaphore!\n");
+        return -1;
+    }
+    return pool_fork(slot, index, size, done_fd);
+}
+
+// stops the workers of a pool and unmaps its shared variables
+static void pool_destroy(daemon_slot *slot) {
+    for(int i = 0; i < slot -> worker_count; i++) {
+        kill(slot -> workers[i], SIGTERM);
+    }
+    for(int i = 0; i < slot -> worker_count; i++) {
+        waitpid(slot -> workers[i], NULL, 0);
+    }
+    free(slot -> workers);
+    slot -> workers = NULL;
+    slot -> worker_count = 0;
+    if(slot -> pool != NULL) {
+        sem_destroy(&slot -> pool -> tasks);
+        munmap(slot -> pool, sizeof(pool_shared));
+        slot -> pool = NULL;
+    }
+    if(slot -> shared != NULL) {
+        shared_t = slot -> shared;
+        shared_t -> Z_count = MAX_STOPS;
+        struct_destroy();
+        slot -> shared = NULL;
+    }
+}
+
+// takes bus and skier tasks of the pool's jobs until the daemon stops it
+static void pool_worker(daemon_slot *slot, int index, int done_fd) {
+    // workers go away with the daemon
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    pool_done_fd = done_fd;
+    pool_index = index;
+    // workers respawned after a stall would inherit the daemon's handlers and ignore pool_destroy()
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    pool_shared *pool = slot -> pool;
+    int job = 0;
+    while(1) {
+        if(sem_wait(&pool -> tasks) == -1) {
+            continue;
+        }
+        int task = __atomic_fetch_add(&pool -> next_task, 1, __ATOMIC_SEQ_CST);
+        // every job writes to its own file, the daemon has already truncated it
+        if(pool -> job != job) {
+            if(output_file != NULL) {
+                fclose(output_file);
+            }
+            output_file = fopen(pool -> path, "a");
+            if(output_file == NULL) {
+                output_file = fopen("/dev/null", "w");
+            }
+            job = pool -> job;
+            rand_seed(time(NULL) ^ getpid());
+        }
+        if(task == 0) {
+            bus();
+            // tells the daemon that the job is done
+            if(write(done_fd, &index, sizeof(index)) == -1) {
+                fprintf(stderr, "ERROR: Failed to report job %d as done!\n", job);
+            }
+        }
+        else {
+            skier(task);
+        }
+    }
+}
+
+static void daemon_signal(int sig) {
+    (void)sig;
+    daemon_stopping = 1;
+}
+
+// reads the request of a client and queues it as a job once it is complete
+static void daemon_read(daemon_client *client, int epoll_fd, int pool_size, daemon_job **queue_head, daemon_job **queue_tail,
+                        int *job_id) {
+    ssize_t got = read(client -> fd, client -> request + client -> length, DAEMON_MAX_REQUEST - 1 - client -> length);
+    if(got == -1 && (errno == EAGAIN || errno == EINTR)) {
+        return;
+    }
+    if(got <= 0) {
+        close(client -> fd);
+        free(client);
+        return;
+    }
+    client -> length += got;
+    client -> request[client -> length] = '\0';
+    char *newline = strchr(client -> request, '\n');
+    if(newline == NULL) {
+        if(client -> length == DAEMON_MAX_REQUEST - 1) {
+            daemon_reply(client -> fd, "error Request is too long.\n");
+            close(client -> fd);
+            free(client);
+        }
+        return;
+    }
+    *newline = '\0';
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client -> fd, NULL);
+
+    // L Z K TL TB [output path]
+    char *args[7];
+    int count = 0;
+    char *save = NULL;
+    for(char *token = strtok_r(client -> request, " \t\r", &save); token != NULL && count < 7;
+        token = strtok_r(NULL, " \t\r", &save)) {
+        args[count++] = token;
+    }
+    daemon_job *job = calloc(1, sizeof(daemon_job));
+    const char *error = NULL;
+    if(job == NULL) {
+        error = "Memory allocation failed.";
+    }
+    else if(count < 5 || count > 6) {
+        error = "Wrong argument count.";
+    }
+    else {
+        error = parse_scenario(args, FORK_MAX_SKIERS, &job -> sc);
+    }
+    // a worker runs its bus or skier to the end, so the bus and every skier need one at once
+    if(error == NULL && job -> sc.L >= pool_size) {
+        error = "L value is out of range for the pool!";
+    }
+    if(error == NULL) {
+        const char *path = (count == 6) ? args[5] : "proj2.out";
+        if(strlen(path) >= PATH_MAX) {
+            error = "Output path is too long.";
+        }
+        else {
+            strcpy(job -> path, path);
+        }
+    }
+    if(error != NULL) {
+        daemon_reply(client -> fd, "error %s\n", error);
+        close(client -> fd);
+        free(client);
+        free(job);
+        return;
+    }
+
+    job -> id = ++(*job_id);
+    job -> client = client -> fd;
+    job -> request_us = monotonic_us();
+    if(*queue_tail == NULL) {
+        *queue_head = job;
+    }
+    else {
+        (*queue_tail) -> next = job;
+    }
+    *queue_tail = job;
+    free(client);
+}
+
+// hands the job's bus and skier tasks to the idle pool, returns -1 if the job failed
+static int daemon_start_job(daemon_slot *slot, daemon_job *job) {
+    // the workers append to the file, so it is truncated here
+    int fd = open(job -> path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if(fd == -1) {
+        daemon_reply(job -> client, "error File failed to open\n");
+        close(job -> client);
+        free(job);
+        return -1;
+    }
+    close(fd);
+
+    shared_t = slot -> shared;
+    // the semaphores are left as the previous job ended, so they start over
+    shared_t -> Z_count = MAX_STOPS;
+    semaphore_destroy();
+    semaphore_init(MAX_STOPS);
+    job -> start_us = monotonic_us();
+    shared_reset(&job -> sc, job -> start_us);
+
+    strcpy(slot -> pool -> path, job -> path);
+    slot -> pool -> next_task = 0;
+    slot -> pool -> job = job -> id;
+    slot -> job = job;
+    // task 0 is the bus, the rest are skiers
+    for(int i = 0; i <= job -> sc.L; i++) {
+        sem_post(&slot -> pool -> tasks);
+    }
+    return 0;
+}
+
+// replies the statistics of the pool's finished job to its client
+static void daemon_finish_job(daemon_slot *slot) {
+    daemon_job *job = slot -> job;
+    if(job == NULL) {
+        return;
+    }
+    shared_t = slot -> shared;
+    if(shared_t -> stalled) {
+        daemon_reply(job -> client, "error stalled\n");
+        fprintf(stderr, "daemon: job %d (%d %d %d %d %d) stalled, its pool gets new workers\n",
+                job -> id, job -> sc.L, job -> sc.Z, job -> sc.K, job -> sc.TL, job -> sc.TB);
+        close(job -> client);
+        free(job);
+        slot -> job = NULL;
+        return;
+    }
+    uint64_t end_us = monotonic_us();
+    uint64_t first_event_us = 0; // latency from the request to the first line
+    if(shared_t -> first_event_us > job -> request_us) {
+        first_event_us = shared_t -> first_event_us - job -> request_us;
+    }
+    route_stats *stats = &shared_t -> stats;
+    double mean_wait_us = (stats -> boardings > 0) ? (double)stats -> wait_us / stats -> boardings : 0.0;
+    daemon_reply(job -> client, "ok job %d lines %d queued_us %llu first_event_us %llu run_us %llu laps %ld mean_wait_us %.1f\n",
+                 job -> id, *(shared_t -> A), (unsigned long long)(job -> start_us - job -> request_us),
+                 (unsigned long long)first_event_us, (unsigned long long)(end_us - job -> start_us),
+                 stats -> laps, mean_wait_us);
+    fprintf(stderr, "daemon: job %d (%d %d %d %d %d) done, first event %.3f ms after the request, %.3f ms in total\n",
+            job -> id, job -> sc.L, job -> sc.Z, job -> sc.K, job -> sc.TL, job -> sc.TB,
+            first_event_us / 1e3, (end_us - job -> request_us) / 1e3);
+    close(job -> client);
+    free(job);
+    slot -> job = NULL;
+}
+
+// sends a formatted reply to a client
+static void daemon_reply(int fd, const char *format, ...) {
+    char reply[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(reply, sizeof(reply), format, args);
+    va_end(args);
+    if(length > (int)sizeof(reply) - 1) {
+        length = sizeof(reply) - 1;
+    }
+    if(send(fd, reply, length, MSG_NOSIGNAL) == -1) {
+        // the client is gone, nothing to tell
+    }
+}
+
+// returns how many simulation processes may run at once given RLIMIT_NPROC and available memory
+static long spawn_budget(long wanted) {
+    long budget = wanted;
+    struct rlimit limit;
+    if(getrlimit(RLIMIT_NPROC, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+        long left = (long)limit.rlim_cur - count_user_processes() - SPAWN_RESERVE;
+        if(left < budget) {
+            budget = left;
+        }
+    }
+    long memory = available_memory();
+    if(memory > 0 && memory / SPAWN_PROC_BYTES < budget) {
+        budget = memory / SPAWN_PROC_BYTES;
+    }
+    return (budget > 0) ? budget : 0;
+}
+
+// returns the number of tasks (threads count against RLIMIT_NPROC too) owned by this user
+static long count_user_processes() {
+    DIR *proc = opendir("/proc");
+    if(proc == NULL) {
+        return 0;
+    }
+    uid_t uid = getuid();
+    long count = 0;
+    struct dirent *entry;
+    char path[sizeof(entry -> d_name) + 16];
+    struct stat info;
+    while((entry = readdir(proc)) != NULL) {
+        if(entry -> d_name[0] < '0' || entry -> d_name[0] > '9') {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/proc/%s/task", entry -> d_name);
+        if(stat(path, &info) == 0 && info.st_uid == uid) {
+            // the task directory links to itself, its parent and one entry per thread
+            count += (info.st_nlink > 2) ? (long)info.st_nlink - 2 : 1;
+        }
+    }
+    closedir(proc);
+    return count;
+}
+
+// returns the memory available for new processes in bytes, or -1 if unknown
+static long available_memory() {
+    FILE *meminfo = fopen("/proc/meminfo", "r");
+    if(meminfo != NULL) {
+        char line[128];
+        long kib;
+        while(fgets(line, sizeof(line), meminfo) != NULL) {
+            if(sscanf(line, "MemAvailable: %ld kB", &kib) == 1) {
+                fclose(meminfo);
+                return kib * 1024;
+            }
+        }
+        fclose(meminfo);
+    }
+    long pages = sysconf(_SC_AVPHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+    if(pages == -1 || page_size == -1) {
+        return -1;
+    }
+    return pages * page_size;
+}
+
+// forks a process, keeping at most the budget of them running; when fork()
+// fails it waits for a skier to exit or backs off and retries, and returns -1
+// once it gives up
+static pid_t spawn_process(spawn_stats *spawn, long *running) {
+    long backoff_us = SPAWN_BACKOFF_US;
+    for(int attempt = 0; ; attempt++) {
+        // the bus never exits before all skiers have been spawned, so a wait returns a skier
+        if(*running >= spawn -> budget && *running > 1) {
+            if(wait(NULL) > 0) {
+                (*running)--;
+            }
+            spawn -> throttled++;
+        }
+        pid_t pid = fork();
+        if(pid != -1) {
+            if(pid > 0) {
+                (*running)++;
+            }
+            return pid;
+        }
+        spawn -> failures++;
+        if((errno != EAGAIN && errno != ENOMEM) || attempt == SPAWN_MAX_RETRIES) {
+            return -1;
+        }
+        spawn -> retries++;
+        if(*running > 1) {
+            // the limit is lower than estimated, so stay below what is running now
+            spawn -> budget = *running;
+        }
+        else {
+            usleep(backoff_us);
+            backoff_us *= 2;
+        }
+    }
+}
+
+// prints statistics of process creation
+static void spawn_print_stats(spawn_stats *spawn) {
+    fprintf(stderr, "spawn: %ld processes wanted, budget %ld at once, %ld fork failures, %ld retries, %ld throttled\n",
+            spawn -> wanted, spawn -> budget, spawn -> failures, spawn -> retries, spawn -> throttled);
+}
+
+// initializes the struct of global/shared variables
+static void struct_init(int Z, FILE *file) {
+    // initializes all global variables
+    map_memory(Z);
+    *(shared_t -> A) = 0;
+    shared_t -> L_count = 0;
+    shared_t -> L_total = 0;
+    shared_t -> route = 1;
+    shared_t -> hub_in = NULL;
+    stall_reset();
+    *(shared_t -> L_boarded) = 0;
+    *(shared_t -> L_skiing) = 0;
+    shared_t -> Z_count = 0;
+    shared_t -> skier_max_time = 0;
+    shared_t -> bus_max_time = 0;
+    shared_t -> K_capacity = 0;
+    shared_t -> engine = ENGINE_FORK;
+    shared_t -> express = 0;
+    shared_t -> stops_bitmap = 0;
+    memset(&shared_t -> stats, 0, sizeof(route_stats));
+    shared_t -> runs = 1;
+    shared_t -> deadline_us = 0;
+    shared_t -> first_event_us = 0;
+    shared_t -> measure_memory = 0;
+    shared_t -> pss_kb = 0;
+    memset(shared_t -> soak, 0, sizeof(soak_stats));
+    rand_seed(time(NULL));
+
+    // the file has been opened before anything was mapped
+    output_file = file;
+    semaphore_init(Z);
+}
+
+// sets up the shared variables for a run of the scenario starting at start_us
+static void shared_reset(scenario *sc, uint64_t start_us) {
+    *(shared_t -> A) = 0;
+    shared_t -> L_count = sc -> L;
+    shared_t -> L_total = sc -> L;
+    shared_t -> route = 1;
+    stall_reset();
+    *(shared_t -> L_boarded) = 0;
+    *(shared_t -> L_skiing) = 0;
+    shared_t -> Z_count = sc -> Z;
+    shared_t -> K_capacity = sc -> K;
+    shared_t -> skier_max_time = sc -> TL;
+    shared_t -> bus_max_time = sc -> TB;
+    shared_t -> engine = ENGINE_FORK;
+    shared_t -> express = 0;
+    shared_t -> stops_bitmap = 0;
+    memset(&shared_t -> stats, 0, sizeof(route_stats));
+    shared_t -> runs = 1;
+    shared_t -> deadline_us = 0;
+    shared_t -> first_event_us = 0;
+    shared_t -> measure_memory = 0;
+    shared_t -> pss_kb = 0;
+    shared_t -> start_us = start_us;
+    memset(shared_t -> soak, 0, sizeof(soak_stats));
+    shared_t -> soak -> start_us = start_us;
+
+    // initialize stops to 0
+    for(int i = 0; i < sc -> Z; i++) {
+        shared_t -> stops_waiting[i] = 0;
+    }
+}
+
+static void struct_destroy() {
+    if(output_file != NULL) {
+        fclose(output_file);
+        output_file = NULL;
+    }
+    semaphore_destroy();
+    unmap_memory();
+}
+
+static void semaphore_init(int Z) {
+    // Initialize bus_mutex semaphore
+    if(sem_init(shared_t -> bus_mutex, 1, 0) == -1) {
+        fprintf(stderr, "ERROR: Failed to initialize a semaphore!\n");
+        struct_destroy();
+        exit(1);
+    }
+
+    // Initialize all_skiers_finished semaphore
+    if(sem_init(shared_t -> all_skiers_finished, 1, 0) == -1) {
+        fprintf(stderr, "ERROR: Failed to initialize a semaphore!\n");
+        struct_destroy();
+        exit(1);
+    }
+
+    // Initialize output_mutex semaphore
+    if(sem_init(shared_t -> output_mutex, 1, 1) == -1) {
+        fprintf(stderr, "ERROR: Failed to initialize a semaphore!\n");
+        struct_destroy();
+        exit(1);
+    }
+
+    // Initialize bus_idle semaphore
+    if(sem_init(shared_t -> bus_idle, 1, 0) == -1) {
+        fprintf(stderr, "ERROR: Failed to initialize a semaphore!\n");
+        struct_destroy();
+        exit(1);
+    }
+
+    // Allocate and initialize stops_mutex array of semaphores
+    for(int i = 0; i < Z; i++) {
+        if(sem_init(shared_t -> stops_mutex[i], 1, 0) == -1) {
+            fprintf(stderr, "ERROR: Failed to initialize a semaphore!\n");
+            struct_destroy();
+            exit(1);
+        }
+    }
+}
+
+
+static void semaphore_destroy() {
+    if(shared_t -> bus_mutex != NULL) {
+        sem_destroy(shared_t -> bus_mutex);
+    }
+    if(shared_t -> all_skiers_finished != NULL) {
+        sem_destroy(shared_t -> all_skiers_finished);
+    }
+    if(shared_t -> output_mutex != NULL) {
+        sem_destroy(shared_t -> output_mutex);
+    }
+    if(shared_t -> bus_idle != NULL) {
+        sem_destroy(shared_t -> bus_idle);
+    }
+    if(shared_t -> stops_mutex != NULL) {
+        for(int i = 0; i < shared_t -> Z_mapped; i++) {
+            if(shared_t -> stops_mutex[i] != NULL) {
+                sem_destroy(shared_t -> stops_mutex[i]);
+            }
+        }
+    }   
+}
+
+static void map_memory(int Z) {
+    shared_t = (shared_vars *)mmap(NULL, sizeof(shared_vars), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(shared_t == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Memory mapping failed.\n");
+        exit(1);
+    }
+    shared_t -> Z_mapped = Z;
+    shared_t -> A = (int *)mmap(NULL, sizeof(int), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(shared_t -> A == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Memory mapping failed.\n");
+        struct_destroy();
+        exit(1);
+    }
+    shared_t -> L_boarded = (int *)mmap(NULL, sizeof(int), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(shared_t -> L_boarded == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Memory mapping failed.\n");
+        struct_destroy();
+        exit(1);
+    }
+    shared_t -> L_skiing = (int *)mmap(NULL, sizeof(int), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(shared_t -> L_skiing == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Memory mapping failed.\n");
+        struct_destroy();
+        exit(1);
+    }
+    shared_t -> stops_waiting = (int *)mmap(NULL, Z * sizeof(int), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(shared_t -> stops_waiting == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Memory mapping failed.\n");
+        struct_destroy();
+        exit(1);
+    }
+    shared_t -> soak = (soak_stats *)mmap(NULL, sizeof(soak_stats), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(shared_t -> soak == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Memory mapping failed.\n");
+        struct_destroy();
+        exit(1);
+    }
+    shared_t -> bus_mutex = (sem_t *)mmap(NULL, sizeof(sem_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(shared_t -> bus_mutex == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Memory mapping failed.\n");
+        struct_destroy();
+        exit(1);
+    }
+    shared_t -> all_skiers_finished = (sem_t *)mmap(NULL, sizeof(sem_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(shared_t -> all_skiers_finished == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Memory mapping failed.\n");
+        struct_destroy();
+        exit(1);
+    }
+    shared_t -> output_mutex = (sem_t *)mmap(NULL, sizeof(sem_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(shared_t -> output_mutex == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Memory mapping failed.\n");
+        struct_destroy();
+        exit(1);
+    }
+    shared_t -> bus_idle = (sem_t *)mmap(NULL, sizeof(sem_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(shared_t -> bus_idle == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Memory mapping failed.\n");
+        struct_destroy();
+        exit(1);
+    }
+    shared_t -> stops_mutex = (sem_t **)mmap(NULL, (Z * sizeof(sem_t *)), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(shared_t -> stops_mutex == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Memory mapping failed.\n");
+        struct_destroy();
+        exit(1);
+    }
+    for(int i = 0; i < Z; i++) {
+        shared_t -> stops_mutex[i] = (sem_t *)mmap(NULL, sizeof(sem_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if(shared_t -> stops_mutex[i] == MAP_FAILED) {
+            fprintf(stderr, "ERROR: Memory mapping failed.\n");
+            struct_destroy();
+            exit(1);
+        }
+    }
+}
+
+static void unmap_memory() {
+    for(int i = 0; i < shared_t -> Z_mapped; i++) {
+        if(munmap(shared_t -> stops_mutex[i], sizeof(sem_t)) != 0) {
+            fprintf(stderr, "ERROR: Memory unmapping failed.\n");
+            exit(1);
+        }
+    }
+    if(munmap(shared_t -> stops_mutex, (shared_t -> Z_mapped) * sizeof(sem_t *)) != 0) {
+        fprintf(stderr, "ERROR: Memory unmapping failed.\n");
+        exit(1);
+    }
+    if(munmap(shared_t -> bus_idle, sizeof(sem_t)) != 0) {
+        fprintf(stderr, "ERROR: Memory unmapping failed.\n");
+        exit(1);
+    }
+    if(munmap(shared_t -> output_mutex, sizeof(sem_t)) != 0) {
+        fprintf(stderr, "ERROR: Memory unmapping failed.\n");
+        exit(1);
+    }
+    if(munmap(shared_t -> all_skiers_finished, sizeof(sem_t)) != 0) {
+        fprintf(stderr, "ERROR: Memory unmapping failed.\n");
+        exit(1);
+    }
+    if(munmap(shared_t -> bus_mutex, sizeof(sem_t)) != 0) {
+        fprintf(stderr, "ERROR: Memory unmapping failed.\n");
+        exit(1);
+    }
+    if(munmap(shared_t -> soak, sizeof(soak_stats)) != 0) {
+        fprintf(stderr, "ERROR: Memory unmapping failed.\n");
+        exit(1);
+    }
+    if(munmap(shared_t -> L_skiing, sizeof(int)) != 0) {
+        fprintf(stderr, "ERROR: Memory unmapping failed.\n");
+        exit(1);
+    }
+    if(munmap(shared_t -> stops_waiting, (shared_t -> Z_mapped) * sizeof(int)) != 0) {
+        fprintf(stderr, "ERROR: Memory unmapping failed.\n");
+        exit(1);
+    }
+    if(munmap(shared_t -> L_boarded, sizeof(int)) != 0) {
+        fprintf(stderr, "ERROR: Memory unmapping failed.\n");
+        exit(1);
+    }
+    if(munmap(shared_t -> A, sizeof(int)) != 0) {
+        fprintf(stderr, "ERROR: Memory unmapping failed.\n");
+        exit(1);
+    }
+    if(munmap(shared_t, sizeof(shared_vars)) != 0) {
+        fprintf(stderr, "ERROR: Memory unmapping failed.\n");
+        exit(1);
+    }
+}
+
+static void custom_print(char *output, ...) {
+    // before posting the semaphore it segfaults somewhere
+    stall_wait(shared_t -> output_mutex, WAIT_OUTPUT, 0); // waits for output to be done
+    int line = ++(*(shared_t -> A));
+    va_list args;
+    if(line == 1) {
+        shared_t -> first_event_us = monotonic_us();
+    }
+    // the line is kept for the stall dump and written to the file from there
+    char *text = shared_t -> log[line % STALL_LOG_LINES];
+    int length = snprintf(text, STALL_LOG_BYTES, "%d: ", line);
+    va_start(args, output);
+    length += vsnprintf(text + length, STALL_LOG_BYTES - length, output, args);
+    va_end(args);
+    // optimizer replicas only count the lines
+    if(output_file != NULL) {
+        if(length < STALL_LOG_BYTES) {
+            fputs(text, output_file);
+        }
+        else {
+            va_start(args, output);
+            fprintf(output_file, "%d: ", line);
+            vfprintf(output_file, output, args);
+            va_end(args);
+        }
+        // coroutines share this process's buffer, so only processes need to flush
+        if(shared_t -> engine == ENGINE_FORK) {
+            fflush(output_file);
+        }
+    }
+    // the coroutines of a library run hand their lines to its sink directly
+    else if(line_sim != NULL) {
+        if(length < STALL_LOG_BYTES) {
+            sink_line(line_sim, text, length);
+        }
+        else {
+            char long_text[512];
+            int prefix = snprintf(long_text, sizeof(long_text), "%d: ", line);
+            va_start(args, output);
+            vsnprintf(long_text + prefix, sizeof(long_text) - prefix, output, args);
+            va_end(args);
+            sink_line(line_sim, long_text, strlen(long_text));
+        }
+    }
+    sem_post(shared_t -> output_mutex); // signals that output is done
+}
+
+// waits on the semaphore of the given kind (index = stop of a stops_mutex) like sem_wait(),
+// if the run writes no line for the stall timeout meanwhile, dumps its state and exits
+static void stall_wait(sem_t *sem, int kind, int index) {
+    wait_stats *stats = &shared_t -> waits[kind];
+    __atomic_add_fetch(&stats -> count, 1, __ATOMIC_RELAXED);
+    // most waits do not block and cost no clock reads
+    if(sem_trywait(sem) == 0) {
+        return;
+    }
+    uint64_t start_us = monotonic_us();
+    int lines = __atomic_load_n(shared_t -> A, __ATOMIC_RELAXED);
+    while(1) {
+        int ret;
+        if(stall_timeout_us == 0) {
+            ret = sem_wait(sem);
+        }
+        else {
+            // a stepped wall clock must neither fake a stall nor hide one
+            struct timespec deadline;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_sec += stall_timeout_us / 1000000;
+            deadline.tv_nsec += (stall_timeout_us % 1000000) * 1000;
+            if(deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+            ret = sem_clockwait(sem, CLOCK_MONOTONIC, &deadline);
+        }
+        if(ret == 0) {
+            break;
+        }
+        if(errno != ETIMEDOUT) {
+            continue;
+        }
+        // another process has dumped the state already
+        if(__atomic_load_n(&shared_t -> stalled, __ATOMIC_SEQ_CST)) {
+            process_exit(EXIT_STALL);
+        }
+        // the run goes on, this process just waits for its turn
+        int now = __atomic_load_n(shared_t -> A, __ATOMIC_RELAXED);
+        if(now != lines) {
+            lines = now;
+            continue;
+        }
+        if(__atomic_exchange_n(&shared_t -> stalled, 1, __ATOMIC_SEQ_CST) == 0) {
+            stall_dump(kind, index, monotonic_us() - start_us);
+            // an idle express bus notices the stall once it wakes up
+            bus_wake();
+            // a pool worker hands the job back to the daemon
+            if(pool_done_fd != -1 && write(pool_done_fd, &pool_index, sizeof(pool_index)) == -1) {
+                fprintf(stderr, "ERROR: Failed to report the stall!\n");
+            }
+        }
+        process_exit(EXIT_STALL);
+    }
+    uint64_t waited_us = monotonic_us() - start_us;
+    __atomic_add_fetch(&stats -> blocked, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats -> total_us, waited_us, __ATOMIC_RELAXED);
+    uint64_t max_us = __atomic_load_n(&stats -> max_us, __ATOMIC_RELAXED);
+    while(waited_us > max_us
+          && !__atomic_compare_exchange_n(&stats -> max_us, &max_us, waited_us, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+// prints the shared state of the route to stderr (kind, index = the wait that stalled, -1 = none)
+static void stall_dump(int kind, int index, uint64_t waited_us) {
+    static const char *names[WAIT_KINDS] = {"stops_mutex", "bus_mutex", "all_skiers_finished", "output_mutex"};
+    char who[32];
+    if(stall_self == 0) {
+        snprintf(who, sizeof(who), "BUS");
+    }
+    else if(stall_self > 0) {
+        snprintf(who, sizeof(who), "L %d", stall_self);
+    }
+    else {
+        snprintf(who, sizeof(who), "main");
+    }
+    if(kind == -1) {
+        fprintf(stderr, "STALL: nobody can run, waited %.3f s\n", waited_us / 1e6);
+    }
+    else if(kind == WAIT_STOP) {
+        fprintf(stderr, "STALL: %s waited %.3f s on %s[%d] without a new line\n", who, waited_us / 1e6, names[kind], index - 1);
+    }
+    else {
+        fprintf(stderr, "STALL: %s waited %.3f s on %s without a new line\n", who, waited_us / 1e6, names[kind]);
+    }
+    int lines = *(shared_t -> A);
+    fprintf(stderr, "route %d: bus at %d (%d = final, 0 = not started), lap %ld\n",
+            shared_t -> route, shared_t -> bus_stop, shared_t -> Z_count + 1, shared_t -> stats.laps);
+    fprintf(stderr, "counters: A %d, L_count %d, L_boarded %d, L_skiing %d, boardings %ld, stops_bitmap 0x%x\n",
+            lines, shared_t -> L_count, *(shared_t -> L_boarded), *(shared_t -> L_skiing),
+            shared_t -> stats.boardings, shared_t -> stops_bitmap);
+    int value;
+    for(int i = 0; i < shared_t -> Z_count; i++) {
+        sem_getvalue(shared_t -> stops_mutex[i], &value);
+        fprintf(stderr, "stop %d: %d waiting, stops_mutex %d\n", i + 1, shared_t -> stops_waiting[i], value);
+    }
+    sem_getvalue(shared_t -> bus_mutex, &value);
+    fprintf(stderr, "semaphores: bus_mutex %d", value);
+    sem_getvalue(shared_t -> all_skiers_finished, &value);
+    fprintf(stderr, ", all_skiers_finished %d", value);
+    sem_getvalue(shared_t -> output_mutex, &value);
+    fprintf(stderr, ", output_mutex %d\n", value);
+    for(int i = 0; i < WAIT_KINDS; i++) {
+        wait_stats *stats = &shared_t -> waits[i];
+        fprintf(stderr, "waits on %s: %ld, %ld blocked, mean %.3f ms, max %.3f ms\n", names[i], stats -> count,
+                stats -> blocked, stats -> blocked > 0 ? stats -> total_us / 1e3 / stats -> blocked : 0.0,
+                stats -> max_us / 1e3);
+    }
+    fprintf(stderr, "last lines:\n");
+    for(int line = (lines > STALL_LOG_LINES) ? lines - STALL_LOG_LINES + 1 : 1; line <= lines; line++) {
+        fprintf(stderr, "  %s", shared_t -> log[line % STALL_LOG_LINES]);
+    }
+}
+
+// clears the stall detector's state of the shared variables
+static void stall_reset() {
+    shared_t -> bus_stop = 0;
+    shared_t -> stalled = 0;
+    memset(shared_t -> waits, 0, sizeof(shared_t -> waits));
+    memset(shared_t -> log, 0, sizeof(shared_t -> log));
+}
+
+static void bus() {
+    stall_self = 0;
+    route_pin(shared_t -> route);
+    custom_print("BUS: started\n");
+    int stop = 1;
+    bus_idle_update();
+    trace_bus(TRACE_NONE, 0);
+    // while all skiers aren't skiing
+    while(__atomic_load_n(shared_t -> L_skiing, __ATOMIC_SEQ_CST) != shared_t -> L_count) {
+        // a skier found the run stalled, the express bus may never wait to notice itself
+        if(__atomic_load_n(&shared_t -> stalled, __ATOMIC_RELAXED)) {
+            process_exit(EXIT_STALL);
+        }
+        if(shared_t -> express) {
+            stop = express_next_stop(stop);
+            if(stop == 0) {
+                // nobody is waiting or on board, the bus waits before the first stop until someone comes
+                while(sem_wait(shared_t -> bus_idle) == -1);
+                stop = 1;
+                continue;
+            }
+        }
+        if(stop <= shared_t -> Z_count) {
+            rand_sleep(shared_t -> bus_max_time);
+            int skier_count = bus_arrive(stop);
+            for(int i = 0; i < skier_count; i++) {
+                // allows the skier to board
+                sem_post(shared_t -> stops_mutex[(stop - 1)]);
+            }
+            // every boarding skier signals once it is on
+            for(int i = 0; i < skier_count; i++) {
+                stall_wait(shared_t -> all_skiers_finished, WAIT_FINISHED, 0);
+            }
+            bus_leave(stop);
+            rand_sleep(shared_t -> bus_max_time);
+            // goes to next bus stop
+            stop++;
+        }
+        // if the skibus is on the final stop
+        if(stop == (shared_t -> Z_count) + 1) {
+            int on_board = bus_arrive(stop);
+            for(int i = 0; i < on_board; i++) {
+                sem_post(shared_t -> bus_mutex);
+            }
+            // every skier signals once it is off
+            for(int i = 0; i < on_board; i++) {
+                stall_wait(shared_t -> all_skiers_finished, WAIT_FINISHED, 0);
+            }
+            bus_leave(stop);
+            stop = 1;
+        }
+    }
+    bus_idle_update();
+    custom_print("BUS: finish\n");
+}
+// postion -> current position of skier in total
+static void skier(int position) {
+    stall_self = position;
+    int route = 1;
+    int last_route = 1; // route the skier goes skiing from
+    if(network.journeys != NULL) {
+        route = network.journeys[position - 1][0];
+        last_route = network.journeys[position - 1][1];
+        route_select(route);
+        route_pin(route);
+    }
+    if(arrival_us == NULL) {
+        rand_sleep(shared_t -> skier_max_time);
+    }
+    custom_print("L %d: started\n", position);
+    for(int run = 1; ; run++) {
+        if(run == 1 && arrival_us != NULL) {
+            int delay;
+            while((delay = arrival_delay(position)) > 0) {
+                usleep(delay);
+            }
+        }
+        else {
+            rand_sleep(shared_t -> skier_max_time);
+        }
+        uint64_t arrived_us = monotonic_us();
+        int stop = skier_arrive(position);
+        uint64_t boarded_us;
+        while(1) {
+            // wait until bus arrives
+            stall_wait(shared_t -> stops_mutex[(stop - 1)], WAIT_STOP, stop);
+            boarded_us = skier_board(position, stop, arrived_us);
+            // send signal to bus that this skier has boarded
+            sem_post(shared_t -> all_skiers_finished);
+            // waits until bus arrives to final bus stop
+            stall_wait(shared_t -> bus_mutex, WAIT_BUS, 0);
+            if(route == last_route) {
+                break;
+            }
+            skier_transfer(position, stop, boarded_us, route);
+            sem_post(shared_t -> all_skiers_finished);
+            route++;
+            arrived_us = monotonic_us();
+            stop = skier_hub(position, route);
+        }
+        int again = skier_unboard(position, stop, boarded_us, run);
+        // sends a signal that this skier has gone skiing
+        sem_post(shared_t -> all_skiers_finished);
+        if(!again) {
+            break;
+        }
+    }
+}
+
+// the bus pulls up at the stop (Z + 1 = final), returns how many skiers get on or off there
+static int bus_arrive(int stop) {
+    shared_t -> bus_stop = stop;
+    if(stop <= shared_t -> Z_count) {
+        custom_print("BUS: arrived to %d\n", stop);
+        trace_bus(TRACE_DRIVE, stop);
+        // boards as many waiting skiers as there is room for
+        return stop_board(stop);
+    }
+    custom_print("BUS: arrived to final\n");
+    trace_bus(TRACE_DRIVE, stop);
+    shared_t -> stats.laps++;
+    // all skiers unboard
+    return __atomic_load_n(shared_t -> L_boarded, __ATOMIC_SEQ_CST);
+}
+
+// the bus leaves the stop once everybody has got on or off
+static void bus_leave(int stop) {
+    bus_idle_update();
+    if(stop <= shared_t -> Z_count) {
+        custom_print("BUS: leaving %d\n", stop);
+        trace_bus(TRACE_DWELL, stop);
+        return;
+    }
+    custom_print("BUS: leaving final\n");
+    trace_bus(TRACE_DWELL, stop);
+    trace_record_add(TRACE_ON_BOARD, 0, 0, monotonic_us(), 0);
+}
+
+// the skier comes to a stop and queues there, returns the stop
+static int skier_arrive(int position) {
+    // stop that skier will go to (index)
+    int stop = stop_pick();
+    custom_print("L %d: arrived to %d\n", position, stop);
+    // increment number of waiting skiers at current stop
+    stop_enqueue(stop);
+    return stop;
+}
+
+// the skier that waited at the stop since arrived_us gets on, returns the time it boarded
+static uint64_t skier_board(int position, int stop, uint64_t arrived_us) {
+    custom_print("L %d: boarding\n", position);
+    uint64_t boarded_us = monotonic_us();
+    uint64_t waited_us = boarded_us - arrived_us;
+    trace_record_add(TRACE_WAIT, position, stop, arrived_us, boarded_us);
+    __atomic_add_fetch(&shared_t -> stats.wait_us, waited_us, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&shared_t -> stats.boardings, 1, __ATOMIC_SEQ_CST);
+    soak_record_wait(waited_us);
+    optimize_record_wait(waited_us);
+    return boarded_us;
+}
+
+// the skier gets off at the final stop and goes skiing, returns 1 if it comes back for another run
+static int skier_unboard(int position, int stop, uint64_t boarded_us, int run) {
+    custom_print("L %d: going to ski\n", position);
+    trace_record_add(TRACE_RIDE, position, stop, boarded_us, monotonic_us());
+    soak_record_delivery();
+    int again = skier_goes_again(run);
+    // the bus finishes once every skier has gone skiing for good
+    if(!again) {
+        __atomic_add_fetch(shared_t -> L_skiing, 1, __ATOMIC_SEQ_CST);
+    }
+    __atomic_sub_fetch(shared_t -> L_boarded, 1, __ATOMIC_SEQ_CST);
+    return again;
+}
+
+// the skier gets off at the final stop of the route to change to the next one
+static void skier_transfer(int position, int stop, uint64_t boarded_us, int route) {
+    // the final stop is the hub of the next route
+    custom_print("L %d: transferring to route %d\n", position, route + 1);
+    trace_record_add(TRACE_RIDE, position, stop, boarded_us, monotonic_us());
+    // the bus of this route no longer waits for the skier
+    __atomic_add_fetch(shared_t -> L_skiing, 1, __ATOMIC_SEQ_CST);
+    __atomic_sub_fetch(shared_t -> L_boarded, 1, __ATOMIC_SEQ_CST);
+}
+
+// the skier that transferred queues at the hub of the route, returns its stop
+static int skier_hub(int position, int route) {
+    route_select(route);
+    route_pin(route);
+    custom_print("L %d: arrived to %d\n", position, 1);
+    hub_push(shared_t -> hub_in, position);
+    bus_wake();
+    return 1;
+}
+
+// counts the skier in at the stop and marks the stop as non-empty
+static void stop_enqueue(int stop) {
+    int waiting = __atomic_add_fetch(&shared_t -> stops_waiting[(stop - 1)], 1, __ATOMIC_SEQ_CST);
+    if(trace_fd != -1) {
+        trace_record_add(TRACE_WAITING, stop, waiting, monotonic_us(), 0);
+    }
+    // the first waiting skier wakes an express bus that has nothing to do
+    if(__atomic_fetch_or(&shared_t -> stops_bitmap, 1u << (stop - 1), __ATOMIC_SEQ_CST) == 0) {
+        bus_wake();
+    }
+}
+
+// wakes the express bus if it waits for skiers with nobody on board
+static void bus_wake() {
+    if(!shared_t -> express) {
+        return;
+    }
+    if(shared_t -> engine == ENGINE_CORO) {
+        co_sem_post(&co_sched.idle_sem);
+    }
+    else {
+        sem_post(shared_t -> bus_idle);
+    }
+}
+
+// takes as many waiting skiers off the stop as there are free seats and returns their count
+static int stop_board(int stop) {
+    // skiers from the previous route wait at the hub as if they had arrived here
+    if(stop == 1 && shared_t -> hub_in != NULL) {
+        int transfers = hub_drain(shared_t -> hub_in);
+        if(transfers > 0) {
+            shared_t -> stats.transfers += transfers;
+            __atomic_add_fetch(&shared_t -> stops_waiting[0], transfers, __ATOMIC_SEQ_CST);
+            __atomic_fetch_or(&shared_t -> stops_bitmap, 1u, __ATOMIC_SEQ_CST);
+        }
+    }
+    int count = __atomic_load_n(&shared_t -> stops_waiting[(stop - 1)], __ATOMIC_SEQ_CST);
+    int free_seats = shared_t -> K_capacity - __atomic_load_n(shared_t -> L_boarded, __ATOMIC_SEQ_CST);
+    if(count > free_seats) {
+        count = free_seats;
+    }
+    // skiers that do not fit stay counted for the next lap
+    int left = __atomic_sub_fetch(&shared_t -> stops_waiting[(stop - 1)], count, __ATOMIC_SEQ_CST);
+    if(left == 0) {
+        __atomic_fetch_and(&shared_t -> stops_bitmap, ~(1u << (stop - 1)), __ATOMIC_SEQ_CST);
+        // a skier that arrived in the meantime may have had its bit cleared
+        if(__atomic_load_n(&shared_t -> stops_waiting[(stop - 1)], __ATOMIC_SEQ_CST) > 0) {
+            __atomic_fetch_or(&shared_t -> stops_bitmap, 1u << (stop - 1), __ATOMIC_SEQ_CST);
+        }
+    }
+    int on_board = __atomic_add_fetch(shared_t -> L_boarded, count, __ATOMIC_SEQ_CST);
+    if(trace_fd != -1) {
+        uint64_t now = monotonic_us();
+        trace_record_add(TRACE_WAITING, stop, left, now, 0);
+        trace_record_add(TRACE_ON_BOARD, 0, on_board, now, 0);
+    }
+    return count;
+}
+
+// **********Tracing**********
+
+// creates the trace-event JSON file and writes its header, returns an error message or NULL
+static const char *trace_open(const char *path) {
+    trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0666);
+    if(trace_fd == -1) {
+        return "Trace file failed to open.";
+    }
+    // every record written later starts with a comma
+    dprintf(trace_fd, "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"skibus\"}}");
+    return NULL;
+}
+
+// adds a record to this process's trace buffer, the times are monotonic
+static void trace_record_add(int kind, int track, int value, uint64_t start_us, uint64_t end_us) {
+    if(trace_fd == -1) {
+        return;
+    }
+    // large runs would need too many tracks for their skiers
+    if((kind == TRACE_WAIT || kind == TRACE_RIDE) && shared_t -> L_total > TRACE_MAX_SKIER_TRACKS) {
+        return;
+    }
+    if(trace_length == trace_capacity) {
+        size_t capacity = (trace_capacity == 0) ? 64 : trace_capacity * 2;
+        trace_record *buffer = realloc(trace_buffer, capacity * sizeof(trace_record));
+        if(buffer == NULL) {
+            // the trace loses the record, the simulation goes on
+            return;
+        }
+        trace_buffer = buffer;
+        trace_capacity = capacity;
+    }
+    trace_record *record = &trace_buffer[trace_length++];
+    record -> kind = kind;
+    record -> track = track;
+    record -> value = value;
+    record -> route = shared_t -> route;
+    record -> start_us = start_us - shared_t -> start_us;
+    record -> end_us = (end_us > start_us) ? end_us - shared_t -> start_us : record -> start_us;
+}
+
+// records what the bus has done since the last call
+static void trace_bus(int kind, int stop) {
+    if(trace_fd == -1) {
+        return;
+    }
+    uint64_t now = monotonic_us();
+    if(kind != TRACE_NONE) {
+        trace_record_add(kind, 0, stop, trace_mark_us, now);
+    }
+    trace_mark_us = now;
+}
+
+// appends the trace records of this process to the trace file
+static void trace_flush() {
+    if(trace_fd == -1 || trace_length == 0) {
+        return;
+    }
+    char *text = malloc(trace_length * TRACE_RECORD_BYTES);
+    if(text == NULL) {
+        fprintf(stderr, "ERROR: Memory allocation failed.\n");
+        return;
+    }
+    static const char *names[] = {"", "drive", "dwell", "wait", "ride"};
+    size_t length = 0;
+    for(size_t i = 0; i < trace_length; i++) {
+        trace_record *record = &trace_buffer[i];
+        char *out = text + length;
+        switch(record -> kind) {
+            case TRACE_WAITING:
+                length += snprintf(out, TRACE_RECORD_BYTES,
+                                   ",\n{\"name\":\"stop %d\",\"ph\":\"C\",\"pid\":%d,\"ts\":%llu,\"args\":{\"waiting\":%d}}",
+                                   record -> track, record -> route, (unsigned long long)record -> start_us, record -> value);
+                break;
+            case TRACE_ON_BOARD:
+                length += snprintf(out, TRACE_RECORD_BYTES,
+                                   ",\n{\"name\":\"bus\",\"ph\":\"C\",\"pid\":%d,\"ts\":%llu,\"args\":{\"on board\":%d}}",
+                                   record -> route, (unsigned long long)record -> start_us, record -> value);
+                break;
+            default:
+                length += snprintf(out, TRACE_RECORD_BYTES,
+                                   ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+                                   "\"ts\":%llu,\"dur\":%llu,\"args\":{\"stop\":%d}}",
+                                   names[record -> kind], (record -> track == 0) ? "bus" : "skier", record -> route, record -> track,
+                                   (unsigned long long)record -> start_us,
+                                   (unsigned long long)(record -> end_us - record -> start_us), record -> value);
+                break;
+        }
+    }
+    // one write per process, other processes may be flushing at the same time
+    sem_t *lock = (network.count > 1) ? network.routes[0] -> output_mutex : shared_t -> output_mutex;
+    if(shared_t -> engine == ENGINE_FORK) {
+        stall_wait(lock, WAIT_OUTPUT, 0);
+    }
+    for(size_t written = 0; written < length; ) {
+        ssize_t count = write(trace_fd, text + written, length - written);
+        if(count == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "ERROR: Failed to write the trace!\n");
+            break;
+        }
+        written += count;
+    }
+    if(shared_t -> engine == ENGINE_FORK) {
+        sem_post(lock);
+    }
+    free(text);
+    free(trace_buffer);
+    trace_buffer = NULL;
+    trace_length = 0;
+    trace_capacity = 0;
+}
+
+// names the tracks and closes the trace file once every process has flushed
+static void trace_close() {
+    if(trace_fd == -1) {
+        return;
+    }
+    // every route is a process of its own in the trace
+    for(int route = 1; route <= network.count; route++) {
+        if(network.count > 1) {
+            dprintf(trace_fd, ",\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"route %d\"}}",
+                    route, route);
+        }
+        dprintf(trace_fd, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"bus\"}}", route);
+        if(shared_t -> L_total <= TRACE_MAX_SKIER_TRACKS) {
+            for(int i = 1; i <= shared_t -> L_total; i++) {
+                dprintf(trace_fd, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"L %d\"}}",
+                        route, i, i);
+            }
+        }
+    }
+    dprintf(trace_fd, "\n]\n");
+    close(trace_fd);
+    trace_fd = -1;
+}
+
+// returns the stop the express bus should go to from the given one,
+// Z + 1 for the final stop or 0 if there is nothing to do
+static int express_next_stop(int stop) {
+    unsigned int waiting = __atomic_load_n(&shared_t -> stops_bitmap, __ATOMIC_SEQ_CST);
+    if(shared_t -> hub_in != NULL && hub_pending(shared_t -> hub_in)) {
+        waiting |= 1u;
+    }
+    int on_board = __atomic_load_n(shared_t -> L_boarded, __ATOMIC_SEQ_CST);
+    // stops from this one on that skiers wait at
+    unsigned int ahead = waiting & (~0u << (stop - 1));
+    if(ahead != 0 && on_board < shared_t -> K_capacity) {
+        return __builtin_ctz(ahead) + 1;
+    }
+    if(on_board > 0) {
+        return shared_t -> Z_count + 1;
+    }
+    // an empty bus turns around to the first stop anyone waits at
+    if(waiting != 0) {
+        return __builtin_ctz(waiting) + 1;
+    }
+    return 0;
+}
+
+// accounts the time since the last call as idle if the bus was empty meanwhile
+static void bus_idle_update() {
+    uint64_t now = monotonic_us();
+    if(shared_t -> stats.bus_mark_us != 0 && shared_t -> stats.bus_empty) {
+        shared_t -> stats.bus_idle_us += now - shared_t -> stats.bus_mark_us;
+    }
+    shared_t -> stats.bus_mark_us = now;
+    shared_t -> stats.bus_empty = __atomic_load_n(shared_t -> L_boarded, __ATOMIC_SEQ_CST) == 0;
+}
+
+// prints statistics of the bus route
+static void route_print_stats() {
+    route_stats *stats = &shared_t -> stats;
+    if(network.count > 1) {
+        fprintf(stderr, "route %d: %s, %d skiers, %ld transfers in\n", shared_t -> route,
+                shared_t -> express ? "express" : "all stops", shared_t -> L_count, stats -> transfers);
+    }
+    else {
+        fprintf(stderr, "route: %s\n", shared_t -> express ? "express" : "all stops");
+    }
+    fprintf(stderr, "laps: %ld\n", stats -> laps);
+    fprintf(stderr, "bus idle time: %.3f s\n", stats -> bus_idle_us / 1e6);
+    fprintf(stderr, "mean skier wait: %.3f ms\n",
+            stats -> boardings > 0 ? stats -> wait_us / 1e3 / stats -> boardings : 0.0);
+}
+
+// returns 1 if skiers go back to a stop after skiing
+static int soak_enabled() {
+    return shared_t -> runs != 1 || shared_t -> deadline_us > 0;
+}
+
+// returns 1 if the skier goes back to a stop after the given run
+static int skier_goes_again(int run) {
+    if(shared_t -> runs > 0 && run >= shared_t -> runs) {
+        return 0;
+    }
+    if(shared_t -> deadline_us > 0 && monotonic_us() >= shared_t -> deadline_us) {
+        return 0;
+    }
+    return 1;
+}
+
+// returns the histogram bucket of a wait time
+static int hist_bucket(uint64_t us) {
+    if(us < 16) {
+        return us;
+    }
+    int exponent = 63 - __builtin_clzll(us);
+    if(exponent > 35) {
+        return HIST_BUCKETS - 1;
+    }
+    // 8 sub-buckets per power of 2 starting at 16
+    return 16 + (exponent - 4) * 8 + ((us >> (exponent - 3)) & 7);
+}
+
+// returns the largest wait time that falls into the bucket
+static uint64_t hist_value(int bucket) {
+    if(bucket < 16) {
+        return bucket;
+    }
+    int exponent = (bucket - 16) / 8 + 4;
+    return ((uint64_t)(8 + (bucket - 16) % 8 + 1) << (exponent - 3)) - 1;
+}
+
+// returns the wait time the given fraction of skiers waited at most
+static uint64_t hist_percentile(wait_histogram *hist, double fraction) {
+    uint64_t total = 0;
+    for(int i = 0; i < HIST_BUCKETS; i++) {
+        total += hist -> count[i];
+    }
+    if(total == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(fraction * total + 0.5);
+    if(rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for(int i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist -> count[i];
+        if(seen >= rank) {
+            return hist_value(i);
+        }
+    }
+    return hist_value(HIST_BUCKETS - 1);
+}
+
+// records how long a skier waited at its stop in the soak statistics
+static void soak_record_wait(uint64_t us) {
+    soak_stats *soak = shared_t -> soak;
+    long second = (monotonic_us() - soak -> start_us) / 1000000;
+    int bucket = hist_bucket(us);
+    __atomic_add_fetch(&soak -> seconds[second % SOAK_RING].waits.count[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&soak -> waits.count[bucket], 1, __ATOMIC_RELAXED);
+}
+
+// records a skier that went skiing in the soak statistics
+static void soak_record_delivery() {
+    soak_stats *soak = shared_t -> soak;
+    long second = (monotonic_us() - soak -> start_us) / 1000000;
+    __atomic_add_fetch(&soak -> seconds[second % SOAK_RING].delivered, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&soak -> delivered, 1, __ATOMIC_RELAXED);
+}
+
+// prints throughput and wait time percentiles of every second completed since
+// the last call over a sliding window, and a summary of the whole run if final
+static void soak_report(int final) {
+    soak_stats *soak = shared_t -> soak;
+    uint64_t elapsed_us = monotonic_us() - soak -> start_us;
+    long now = elapsed_us / 1000000;
+    // the bucket of the next second must be empty before anyone writes to it
+    if(soak -> cleared < now + 1) {
+        memset(&soak -> seconds[(now + 1) % SOAK_RING], 0, sizeof(soak_second));
+        soak -> cleared = now + 1;
+    }
+    for(; soak -> reported < now; soak -> reported++) {
+        long last = soak -> reported;
+        long first = (last >= SOAK_WINDOW_S - 1) ? last - SOAK_WINDOW_S + 1 : 0;
+        long delivered = 0;
+        wait_histogram waits;
+        memset(&waits, 0, sizeof(wait_histogram));
+        for(long second = first; second <= last; second++) {
+            soak_second *bucket = &soak -> seconds[second % SOAK_RING];
+            delivered += bucket -> delivered;
+            for(int i = 0; i < HIST_BUCKETS; i++) {
+                waits.count[i] += bucket -> waits.count[i];
+            }
+        }
+        fprintf(stderr, "[%ld s] last %ld s: %.1f skiers/s, wait p50 %.3f ms, p95 %.3f ms, p99 %.3f ms\n",
+                last + 1, last - first + 1, (double)delivered / (last - first + 1),
+                hist_percentile(&waits, 0.50) / 1e3, hist_percentile(&waits, 0.95) / 1e3,
+                hist_percentile(&waits, 0.99) / 1e3);
+    }
+    if(final) {
+        fprintf(stderr, "total %.1f s: %ld skiers delivered, %.1f skiers/s, wait p50 %.3f ms, p95 %.3f ms, p99 %.3f ms\n",
+                elapsed_us / 1e6, soak -> delivered, soak -> delivered / (elapsed_us / 1e6),
+                hist_percentile(&soak -> waits, 0.50) / 1e3, hist_percentile(&soak -> waits, 0.95) / 1e3,
+                hist_percentile(&soak -> waits, 0.99) / 1e3);
+    }
+}
+
+// seeds the random numbers of the simulation
+static void rand_seed(unsigned int seed) {
+    rand_state = seed;
+}
+
+// returns a random number from 0 to RAND_MAX like rand(), but from the simulation's own state
+static int rand_next() {
+    return rand_r(&rand_state);
+}
+
+// returns a random time that does not go over the limit
+static int rand_time(int limit) {
+    int random = rand_next();
+    if(random > limit) {
+        // to not go over the limit
+        random = limit;
+    }
+    return random;
+}
+
+static void rand_sleep(int limit) {
+    usleep(rand_time(limit));
+}
+
+// returns the monotonic clock in micro seconds
+static uint64_t monotonic_us() {
+    if(virtual_us != 0) {
+        return virtual_us;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// prints memory and scheduling statistics of the fork engine
+static void fork_stats(int L, uint64_t start_us) {
+    struct rusage usage;
+    getrusage(RUSAGE_CHILDREN, &usage);
+    uint64_t wall_us = monotonic_us() - start_us;
+    fprintf(stderr, "engine: fork\n");
+    fprintf(stderr, "skiers: %d\n", L);
+    fprintf(stderr, "wall time: %.3f s\n", wall_us / 1e6);
+    fprintf(stderr, "processes: %d\n", L + network.count);
+    fprintf(stderr, "peak rss of the largest process: %ld KiB\n", usage.ru_maxrss);
+    // RSS counts the pages the processes share once per process, PSS splits them among the sharers
+    long pss_kb = 0;
+    for(int route = 1; route <= network.count; route++) {
+        pss_kb += network.routes[route - 1] -> pss_kb;
+    }
+    if(pss_kb > 0) {
+        fprintf(stderr, "memory: %.1f MiB (PSS of every process when it was done, summed)\n", pss_kb / 1024.0);
+    }
+    fprintf(stderr, "context switches: %ld (kernel)\n", usage.ru_nvcsw + usage.ru_nivcsw);
+    for(int route = 1; route <= network.count; route++) {
+        route_select(route);
+        route_print_stats();
+    }
+    route_select(1);
+}
+
+// adds the proportional set size of this process to its route's sum if the run measures memory
+static void memory_record() {
+    if(!shared_t -> measure_memory) {
+        return;
+    }
+    FILE *rollup = fopen("/proc/self/smaps_rollup", "r");
+    if(rollup == NULL) {
+        return;
+    }
+    char line[128];
+    long kb;
+    while(fgets(line, sizeof(line), rollup) != NULL) {
+        if(sscanf(line, "Pss: %ld kB", &kb) == 1) {
+            __atomic_add_fetch(&shared_t -> pss_kb, kb, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    fclose(rollup);
+}
+
+// ends a bus or skier process once its trace and memory figures are handed over, _exit() keeps
+// the atexit handlers and static destructors of the program that runs the library from running again
+static void process_exit(int status) {
+    memory_record();
+    trace_flush();
+    fflush(NULL);
+    _exit(status);
+}
+
+// **********Coroutine engine**********
+
+// allocates the coroutines, the wait queues and the timing wheel
+static void co_init() {
+    int L = shared_t -> L_count;
+    memset(&co_sched, 0, sizeof(co_scheduler));
+    co_sched.coros = calloc(L + 1, sizeof(coro));
+    co_sched.stop_sems = calloc(shared_t -> Z_count, sizeof(co_sem));
+    co_sched.wheel = calloc(WHEEL_SLOTS, sizeof(coro *));
+    if(co_sched.coros == NULL || co_sched.stop_sems == NULL || co_sched.wheel == NULL) {
+        fprintf(stderr, "ERROR: Memory allocation failed.\n");
+        co_destroy();
+        struct_destroy();
+        exit(1);
+    }
+
+    co_sched.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    co_sched.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(co_sched.timer_fd == -1 || co_sched.epoll_fd == -1) {
+        fprintf(stderr, "ERROR: Failed to create the scheduler timer!\n");
+        co_destroy();
+        struct_destroy();
+        exit(1);
+    }
+    struct epoll_event event = {.events = EPOLLIN};
+    if(epoll_ctl(co_sched.epoll_fd, EPOLL_CTL_ADD, co_sched.timer_fd, &event) == -1) {
+        fprintf(stderr, "ERROR: Failed to create the scheduler timer!\n");
+        co_destroy();
+        struct_destroy();
+        exit(1);
+    }
+    co_sched.start_us = monotonic_us();
+
+    // the bus goes first, then the skiers in order
+    co_sched.coros[0].body = co_bus;
+    co_ready(&co_sched.coros[0]);
+    for(int i = 1; i <= L; i++) {
+        co_sched.coros[i].body = co_skier;
+        co_sched.coros[i].id = i;
+        co_ready(&co_sched.coros[i]);
+    }
+    co_sched.alive = L + 1;
+}
+
+static void co_destroy() {
+    if(co_sched.epoll_fd > 0) {
+        close(co_sched.epoll_fd);
+    }
+    if(co_sched.timer_fd > 0) {
+        close(co_sched.timer_fd);
+    }
+    free(co_sched.wheel);
+    free(co_sched.stop_sems);
+    free(co_sched.coros);
+}
+
+// resumes ready coroutines until all of them have returned, returns 0 or EXIT_STALL if they deadlocked
+static int co_run() {
+    int soak = soak_enabled();
+    // an optimizer replica stops as soon as it cannot meet the SLO any more
+    while(co_sched.alive > 0 && slo_budget >= 0) {
+        co_advance_wheel();
+        if(soak) {
+            soak_report(0);
+        }
+        // runs the coroutines that are ready now, later wakeups wait for the next pass
+        coro *batch = co_sched.run_head;
+        co_sched.run_head = NULL;
+        co_sched.run_tail = NULL;
+        while(batch != NULL) {
+            coro *c = batch;
+            batch = c -> next;
+            c -> next = NULL;
+            co_sched.resumes++;
+            c -> body(c);
+            if(c -> resume == CO_DONE) {
+                co_sched.alive--;
+            }
+        }
+        if(co_sched.run_head == NULL && co_sched.alive > 0) {
+            if(co_sched.sleeping == 0) {
+                fprintf(stderr, "ERROR: Simulation deadlocked!\n");
+                stall_dump(-1, 0, 0);
+                return EXIT_STALL;
+            }
+            co_wait_timer();
+        }
+    }
+    return 0;
+}
+
+// prints memory and scheduling statistics of the coroutine engine
+static void co_stats(uint64_t start_us) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    uint64_t wall_us = monotonic_us() - start_us;
+    int L = shared_t -> L_count;
+    size_t bytes = (L + 1) * sizeof(coro) + shared_t -> Z_count * sizeof(co_sem)
+                   + WHEEL_SLOTS * sizeof(coro *);
+    fprintf(stderr, "engine: coro\n");
+    fprintf(stderr, "skiers: %d\n", L);
+    fprintf(stderr, "wall time: %.3f s\n", wall_us / 1e6);
+    fprintf(stderr, "engine memory: %zu B (%.1f B per skier)\n", bytes, (double)bytes / L);
+    fprintf(stderr, "peak rss: %ld KiB\n", usage.ru_maxrss);
+    fprintf(stderr, "context switches: %lu (coroutine), %ld (kernel)\n",
+            co_sched.resumes, usage.ru_nvcsw + usage.ru_nivcsw);
+    fprintf(stderr, "timer wakeups: %lu\n", co_sched.wakeups);
+    route_print_stats();
+}
+
+// appends the coroutine to the run queue
+static void co_ready(coro *c) {
+    c -> next = NULL;
+    if(co_sched.run_tail == NULL) {
+        co_sched.run_head = c;
+    }
+    else {
+        co_sched.run_tail -> next = c;
+    }
+    co_sched.run_tail = c;
+}
+
+// puts the coroutine into the timing wheel slot it should wake up in
+static void co_sleep(coro *c, int us) {
+    if(us <= 0) {
+        co_ready(c);
+        return;
+    }
+    uint64_t now = (monotonic_us() - co_sched.start_us) / WHEEL_TICK_US;
+    if(now < co_sched.wheel_tick) {
+        now = co_sched.wheel_tick;
+    }
+    uint64_t expires = now + (us + WHEEL_TICK_US - 1) / WHEEL_TICK_US;
+    coro **slot = &co_sched.wheel[expires & (WHEEL_SLOTS - 1)];
+    c -> rounds = (expires - co_sched.wheel_tick - 1) / WHEEL_SLOTS;
+    c -> next = *slot;
+    *slot = c;
+    co_sched.sleeping++;
+}
+
+// moves the coroutines whose time has come from the timing wheel to the run queue
+static void co_advance_wheel() {
+    uint64_t now = (monotonic_us() - co_sched.start_us) / WHEEL_TICK_US;
+    while(co_sched.wheel_tick < now && co_sched.sleeping > 0) {
+        co_sched.wheel_tick++;
+        coro **link = &co_sched.wheel[co_sched.wheel_tick & (WHEEL_SLOTS - 1)];
+        while(*link != NULL) {
+            coro *c = *link;
+            if(c -> rounds > 0) {
+                c -> rounds--;
+                link = &c -> next;
+                continue;
+            }
+            *link = c -> next;
+            co_sched.sleeping--;
+            co_ready(c);
+        }
+    }
+    // nothing sleeps, so the wheel can jump straight to the present
+    if(co_sched.sleeping == 0 && co_sched.wheel_tick < now) {
+        co_sched.wheel_tick = now;
+    }
+}
+
+// blocks until the first non-empty slot of the timing wheel is due
+static void co_wait_timer() {
+    uint64_t tick = co_sched.wheel_tick + 1;
+    while(co_sched.wheel[tick & (WHEEL_SLOTS - 1)] == NULL) {
+        tick++;
+    }
+    uint64_t due_us = co_sched.start_us + tick * WHEEL_TICK_US;
+    // in virtual time nothing happens until then, so the clock jumps there
+    if(virtual_us != 0) {
+        virtual_us = due_us;
+        co_sched.wakeups++;
+        return;
+    }
+    struct itimerspec spec = {
+        .it_interval = {0, 0},
+        .it_value = {due_us / 1000000, (due_us % 1000000) * 1000}
+    };
+    if(timerfd_settime(co_sched.timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) == -1) {
+        fprintf(stderr, "ERROR: Failed to arm the scheduler timer!\n");
+        co_destroy();
+        struct_destroy();
+        exit(1);
+    }
+    struct epoll_event event;
+    if(epoll_wait(co_sched.epoll_fd, &event, 1, -1) == 1) {
+        uint64_t expirations;
+        if(read(co_sched.timer_fd, &expirations, sizeof(expirations)) == -1) {
+            // a signal interrupted the read, the wheel is advanced anyway
+        }
+    }
+    co_sched.wakeups++;
+}
+
+// returns 1 if the semaphore was decremented, 0 if the coroutine has to wait
+static int co_sem_wait(co_sem *sem, coro *c) {
+    if(sem -> value > 0) {
+        sem -> value--;
+        return 1;
+    }
+    c -> next = NULL;
+    if(sem -> tail == NULL) {
+        sem -> head = c;
+    }
+    else {
+        sem -> tail -> next = c;
+    }
+    sem -> tail = c;
+    return 0;
+}
+
+// wakes the first waiting coroutine or remembers the post for a later wait
+static void co_sem_post(co_sem *sem) {
+    coro *c = sem -> head;
+    if(c == NULL) {
+        sem -> value++;
+        return;
+    }
+    sem -> head = c -> next;
+    if(sem -> head == NULL) {
+        sem -> tail = NULL;
+    }
+    co_ready(c);
+}
+
+// bus() as a coroutine
+static void co_bus(coro *c) {
+    CO_BEGIN(c);
+    custom_print("BUS: started\n");
+    c -> stop = 1;
+    bus_idle_update();
+    trace_bus(TRACE_NONE, 0);
+    // while all skiers aren't skiing
+    while(*(shared_t -> L_skiing) != shared_t -> L_count) {
+        if(shared_t -> express) {
+            c -> stop = express_next_stop(c -> stop);
+            if(c -> stop == 0) {
+                // nobody is waiting or on board, the bus waits before the first stop until someone comes
+                CO_WAIT(c, &co_sched.idle_sem);
+                c -> stop = 1;
+                continue;
+            }
+        }
+        if(c -> stop <= shared_t -> Z_count) {
+            CO_SLEEP(c, rand_time(shared_t -> bus_max_time));
+            c -> count = bus_arrive(c -> stop);
+            for(c -> i = 0; c -> i < c -> count; c -> i++) {
+                co_sem_post(&co_sched.stop_sems[(c -> stop - 1)]);
+            }
+            // waits until every boarding skier is on
+            for(c -> i = 0; c -> i < c -> count; c -> i++) {
+                CO_WAIT(c, &co_sched.finished_sem);
+            }
+            bus_leave(c -> stop);
+            CO_SLEEP(c, rand_time(shared_t -> bus_max_time));
+            // goes to next bus stop
+            c -> stop++;
+        }
+        // if the skibus is on the final stop
+        if(c -> stop == (shared_t -> Z_count) + 1) {
+            c -> count = bus_arrive(c -> stop);
+            for(c -> i = 0; c -> i < c -> count; c -> i++) {
+                co_sem_post(&co_sched.bus_sem);
+            }
+            // waits until every skier is off
+            for(c -> i = 0; c -> i < c -> count; c -> i++) {
+                CO_WAIT(c, &co_sched.finished_sem);
+            }
+            bus_leave(c -> stop);
+            c -> stop = 1;
+        }
+    }
+    bus_idle_update();
+    custom_print("BUS: finish\n");
+    CO_END(c);
+}
+
+// skier() as a coroutine
+static void co_skier(coro *c) {
+    // locals are only valid until the next yield
+    int again;
+    CO_BEGIN(c);
+    if(arrival_us == NULL) {
+        CO_SLEEP(c, rand_time(shared_t -> skier_max_time));
+    }
+    custom_print("L %d: started\n", c -> id);
+    for(c -> i = 1; ; c -> i++) {
+        if(c -> i == 1 && arrival_us != NULL) {
+            while(arrival_delay(c -> id) > 0) {
+                CO_SLEEP(c, arrival_delay(c -> id));
+            }
+        }
+        else {
+            CO_SLEEP(c, rand_time(shared_t -> skier_max_time));
+        }
+        c -> since = monotonic_us();
+        c -> stop = skier_arrive(c -> id);
+        // wait until bus arrives
+        CO_WAIT(c, &co_sched.stop_sems[(c -> stop - 1)]);
+        // from now on the skier keeps the time it boarded
+        c -> since = skier_board(c -> id, c -> stop, c -> since);
+        co_sem_post(&co_sched.finished_sem);
+        // waits until bus arrives to final bus stop, routes run on the fork engine only so nobody transfers
+        CO_WAIT(c, &co_sched.bus_sem);
+        again = skier_unboard(c -> id, c -> stop, c -> since, c -> i);
+        co_sem_post(&co_sched.finished_sem);
+        if(!again) {
+            break;
+        }
+    }
+    CO_END(c);
+}
\ No newline at end of file
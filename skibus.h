@@ -0,0 +1,78 @@
+#ifndef SKIBUS_H
+#define SKIBUS_H
+
+#include <stddef.h>
+
+// In-process interface of the skibus simulation (libskibus). A simulation is
+// configured with a scenario, options and a sink for its output lines, started
+// with skibus_run() and collected with skibus_wait():
+//
+//     skibus_sim *sim = skibus_create();
+//     skibus_backend(sim, SKIBUS_CORO);
+//     skibus_scenario(sim, 1000, 5, 50, 1000, 100);
+//     skibus_sink_buffer(sim);
+//     if(skibus_run(sim) == NULL && skibus_wait(sim) == 0) {
+//         const char *lines = skibus_buffer(sim, &length);
+//     }
+//     skibus_destroy(sim);
+//
+// Functions returning const char * return an error message, or NULL on
+// success. The engine keeps its state in process-wide variables, so a
+// process runs one simulation at a time. The fork backend and the optimizer
+// fork one supervisor process whose children do the work, and wait only for
+// the supervisor. The simulation draws its random numbers from a state of its
+// own and leaves rand() of the program alone.
+// Fatal errors (a failed memory mapping or allocation) end the process, as
+// they end proj2; output and trace files that cannot be opened fail
+// skibus_run().
+
+#define SKIBUS_API __attribute__((visibility("default")))
+
+// Execution backends
+#define SKIBUS_FORK 0 // one process per skier and one for the bus
+#define SKIBUS_CORO 1 // bus and skiers as coroutines inside the calling process
+
+#define SKIBUS_STALL 3 // skibus_wait() result of a run the stall detector stopped
+
+// Receives every output line ("A: ...\n", NUL terminated) in order. The
+// coroutine backend calls it from skibus_wait(), the fork backend from a
+// thread of the library that reads the lines the processes write to a pipe.
+typedef void (*skibus_event_fn)(void *context, const char *line, size_t length);
+
+typedef struct skibus_sim skibus_sim;
+
+// allocates a simulation with the defaults of the proj2 program and no sink (NULL = out of memory)
+SKIBUS_API skibus_sim *skibus_create(void);
+// frees the simulation, waiting for it first if it is running
+SKIBUS_API void skibus_destroy(skibus_sim *sim);
+
+// sets the scenario (L skiers, Z stops, capacity K, max skier time TL, max bus ride TB)
+SKIBUS_API const char *skibus_scenario(skibus_sim *sim, int L, int Z, int K, int TL, int TB);
+// sets the scenario from the five positional arguments of proj2
+SKIBUS_API const char *skibus_scenario_args(skibus_sim *sim, char *args[]);
+// chooses SKIBUS_FORK or SKIBUS_CORO
+SKIBUS_API const char *skibus_backend(skibus_sim *sim, int backend);
+// sets a long option of proj2 by name ("stats" and "express" take no value)
+SKIBUS_API const char *skibus_option(skibus_sim *sim, const char *name, const char *value);
+
+// writes the output lines to the file (with routes, PATH.R.out for PATH.out)
+SKIBUS_API const char *skibus_sink_file(skibus_sim *sim, const char *path);
+// passes the output lines to the callback
+SKIBUS_API void skibus_sink_callback(skibus_sim *sim, skibus_event_fn callback, void *context);
+// collects the output lines in memory, see skibus_buffer()
+SKIBUS_API void skibus_sink_buffer(skibus_sim *sim);
+// returns the lines collected by the buffer sink (NUL terminated, valid until the next run)
+SKIBUS_API const char *skibus_buffer(skibus_sim *sim, size_t *length);
+
+// starts the simulation, the fork backend returns once its processes are running
+SKIBUS_API const char *skibus_run(skibus_sim *sim);
+// finishes the simulation (the coroutine backend runs it here), returns 0, 1 or SKIBUS_STALL
+SKIBUS_API int skibus_wait(skibus_sim *sim);
+
+// searches the cheapest K and TB meeting the "optimize" option's p99 wait, reports to stdout,
+// returns 0 or 1 like proj2
+SKIBUS_API int skibus_optimize(skibus_sim *sim);
+// serves scenarios on the "daemon" option's UNIX socket until SIGINT/SIGTERM, returns 0 or 1
+SKIBUS_API int skibus_serve(skibus_sim *sim);
+
+#endif